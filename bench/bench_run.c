@@ -0,0 +1,118 @@
+// Compile: gcc -O2 bench/bench_run.c -o bench/bench_run
+// Run: ./bench/bench_run [-t seconds] <input> <output> <command> [args...]
+//
+// Runs one command with stdin from <input>, stdout to <output> and stderr
+// discarded, then prints one JSON object:
+//   {"wall_ms": ..., "peak_rss_kb": ..., "read_syscalls": ...,
+//    "write_syscalls": ..., "exit": ..., "timeout": ...}
+// peak_rss_kb is the largest single process in the tree. The syscall counts
+// come from /proc/<pid>/io, read while the command is a zombie so they
+// include every child it waited for (mappers and reducers under ./main).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void read_io_counts(pid_t pid, long long *syscr, long long *syscw) {
+    char path[64];
+    char line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    *syscr = *syscw = -1;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "syscr: %lld", syscr);
+        sscanf(line, "syscw: %lld", syscw);
+    }
+    fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+    double timeout = 0;
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-t") == 0) {
+        timeout = atof(argv[argi + 1]);
+        argi += 2;
+    }
+    if (argc - argi < 3) {
+        fprintf(stderr, "Usage: %s [-t seconds] <input> <output> <command> [args...]\n", argv[0]);
+        return 1;
+    }
+
+    const char *input = argv[argi];
+    const char *output = argv[argi + 1];
+    char **cmd = argv + argi + 2;
+
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid == 0) {
+        // Own process group so a timeout can take down the whole tree
+        setpgid(0, 0);
+        int in = open(input, O_RDONLY);
+        int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0 || err < 0) {
+            perror("open");
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        execvp(cmd[0], cmd);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+
+    // Wait without reaping so /proc/<pid>/io is still readable
+    int timed_out = 0;
+    siginfo_t info;
+    for (;;) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT | WNOHANG) < 0) {
+            if (errno == EINTR) continue;
+            perror("waitid");
+            return 1;
+        }
+        if (info.si_pid == pid) break;
+        if (!timed_out && timeout > 0 && now_ms() - start > timeout * 1000) {
+            timed_out = 1;
+            kill(-pid, SIGKILL);
+        }
+        usleep(1000);
+    }
+    double wall = now_ms() - start;
+
+    long long syscr, syscw;
+    read_io_counts(pid, &syscr, &syscw);
+
+    int status;
+    waitpid(pid, &status, 0);
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    printf("{\"wall_ms\": %.3f, \"peak_rss_kb\": %ld, \"read_syscalls\": %lld, "
+           "\"write_syscalls\": %lld, \"exit\": %d, \"timeout\": %s}\n",
+           wall, ru.ru_maxrss, syscr, syscw, code, timed_out ? "true" : "false");
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Compile: gcc -O2 bench/gen_corpus.c -o bench/gen_corpus -lm
+// Run: ./bench/gen_corpus <zipf|uniform|longline|punct> <size> [seed] [vocab] > corpus.txt
+//
+// Writes a deterministic synthetic corpus of roughly <size> bytes (suffixes
+// K, M, G accepted). The same kind, size, seed and vocab always produce the
+// same bytes, so benchmark runs on different commits see identical input.
+//   zipf      words drawn with Zipf(1.0) frequencies, 8-16 words per line
+//   uniform   every vocabulary word equally likely
+//   longline  Zipf words on lines of ~64KB, far past the mapper's buffers
+//   punct     Zipf words with capitals, possessives, hyphens, quotes,
+//             numbers and trailing punctuation
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define DEFAULT_VOCAB 50000
+#define MAX_WORD 16
+
+uint64_t rng_state;
+
+// splitmix64: small, fast and identical on every platform
+uint64_t next_rand() {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform double in [0, 1)
+double next_double() {
+    return (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int rand_range(int lo, int hi) {
+    return lo + (int)(next_rand() % (uint64_t)(hi - lo + 1));
+}
+
+char (*vocab)[MAX_WORD + 1];
+double *zipf_cdf;
+int vocab_size;
+
+void build_vocab() {
+    vocab = malloc(vocab_size * sizeof(*vocab));
+    zipf_cdf = malloc(vocab_size * sizeof(double));
+    if (!vocab || !zipf_cdf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    // Short words are the common ones, as in natural text
+    for (int i = 0; i < vocab_size; i++) {
+        int max_len = 3 + (int)log2(i + 2);
+        if (max_len > MAX_WORD) max_len = MAX_WORD;
+        int len = rand_range(1, max_len);
+        for (int j = 0; j < len; j++) {
+            vocab[i][j] = 'a' + rand_range(0, 25);
+        }
+        vocab[i][len] = '\0';
+    }
+
+    double total = 0;
+    for (int i = 0; i < vocab_size; i++) {
+        total += 1.0 / (i + 1);
+        zipf_cdf[i] = total;
+    }
+    for (int i = 0; i < vocab_size; i++) {
+        zipf_cdf[i] /= total;
+    }
+}
+
+int zipf_word() {
+    double u = next_double();
+    int lo = 0, hi = vocab_size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Write one word in the "punct" style; returns bytes written
+int write_punct_word(const char *word, FILE *out) {
+    char buf[MAX_WORD * 2 + 16];
+    int len = 0;
+    int r = rand_range(0, 99);
+
+    if (r < 5) {
+        return fprintf(out, "%d", rand_range(0, 9999));
+    }
+    if (r < 10) len += sprintf(buf + len, "\"");
+    else if (r < 13) len += sprintf(buf + len, "\xE2\x80\x9C");
+
+    len += sprintf(buf + len, "%s", word);
+    if (rand_range(0, 99) < 30) buf[len - (int)strlen(word)] -= 32;
+
+    r = rand_range(0, 99);
+    if (r < 10) len += sprintf(buf + len, "'s");
+    else if (r < 13) len += sprintf(buf + len, "\xE2\x80\x99s");
+    else if (r < 18) len += sprintf(buf + len, "-%s", vocab[zipf_word()]);
+
+    r = rand_range(0, 99);
+    if (r < 20) buf[len++] = ".,;:!?"[rand_range(0, 5)];
+    else if (r < 23) len += sprintf(buf + len, "\xE2\x80\x94");
+
+    return fwrite(buf, 1, len, out);
+}
+
+unsigned long long parse_size(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; break;
+    case 'm': case 'M': v *= 1024 * 1024; break;
+    case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+    }
+    return (unsigned long long)v;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <zipf|uniform|longline|punct> <size> [seed] [vocab]\n", argv[0]);
+        return 1;
+    }
+
+    const char *kind = argv[1];
+    unsigned long long target = parse_size(argv[2]);
+    rng_state = argc > 3 ? strtoull(argv[3], NULL, 10) : 42;
+    vocab_size = argc > 4 ? atoi(argv[4]) : DEFAULT_VOCAB;
+    if (vocab_size < 1) vocab_size = DEFAULT_VOCAB;
+
+    int uniform = strcmp(kind, "uniform") == 0;
+    int longline = strcmp(kind, "longline") == 0;
+    int punct = strcmp(kind, "punct") == 0;
+    if (!uniform && !longline && !punct && strcmp(kind, "zipf") != 0) {
+        fprintf(stderr, "Unknown corpus kind: %s\n", kind);
+        return 1;
+    }
+
+    build_vocab();
+
+    static char outbuf[1 << 20];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    unsigned long long written = 0;
+    while (written < target) {
+        int words = longline ? rand_range(8000, 12000) : rand_range(8, 16);
+        for (int i = 0; i < words; i++) {
+            int w = uniform ? rand_range(0, vocab_size - 1) : zipf_word();
+            if (i > 0) {
+                putchar(' ');
+                written++;
+            }
+            if (punct) {
+                written += write_punct_word(vocab[w], stdout);
+            } else {
+                written += fputs(vocab[w], stdout) >= 0 ? strlen(vocab[w]) : 0;
+            }
+        }
+        putchar('\n');
+        written++;
+    }
+
+    return 0;
+}
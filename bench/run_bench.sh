@@ -0,0 +1,122 @@
+#!/bin/bash
+# Benchmark the pipeline and each stage on deterministic synthetic corpora.
+#
+# Usage: bash bench/run_bench.sh [-s "10M 100M 1G"] [-k "zipf uniform longline punct"]
+#                                [-r reps] [-t timeout] [-f "main flags"] [-o results.json]
+#
+# For every corpus kind and size it times three stages, each run <reps> times:
+#   pipeline  ./main <flags> < corpus
+#   mapper    ./mapper < corpus
+#   reducer   ./reducer < (mapper output for the corpus)
+# and prints one JSON document with throughput (MB/s at the median), the
+# min/median/max wall time over the reps, peak RSS of the largest process and
+# read/write syscall counts. A handful of whole runs has no meaningful tail,
+# so no higher percentiles are reported; raise -r to see the spread.
+# Corpora are generated once into bench/data and reused across commits.
+
+cd "$(dirname "$0")/.."
+
+sizes="10M"
+kinds="zipf uniform longline punct"
+reps=5
+timeout=600
+main_flags=""
+out=""
+seed=42
+
+while getopts "s:k:r:t:f:o:" opt; do
+	case $opt in
+	s) sizes=$OPTARG ;;
+	k) kinds=$OPTARG ;;
+	r) reps=$OPTARG ;;
+	t) timeout=$OPTARG ;;
+	f) main_flags=$OPTARG ;;
+	o) out=$OPTARG ;;
+	*) echo "Usage: $0 [-s sizes] [-k kinds] [-r reps] [-t timeout] [-f main-flags] [-o file]" >&2; exit 1 ;;
+	esac
+done
+
+make -s all bench/gen_corpus bench/bench_run >&2 || exit 1
+mkdir -p bench/data
+
+# Pull one numeric field out of bench_run's JSON line
+field() {
+	sed -n "s/.*\"$1\": \([^,}]*\).*/\1/p" <<<"$2"
+}
+
+# percentile <p> <values...>: nearest-rank percentile (0 is the minimum)
+percentile() {
+	local p=$1
+	shift
+	printf '%s\n' "$@" | sort -g | awk -v p="$p" '
+		{ v[NR] = $1 }
+		END { r = int((p * NR + 99) / 100); if (r < 1) r = 1; print v[r] }'
+}
+
+# run_stage <name> <input> <command...>: prints one JSON result object
+run_stage() {
+	local stage=$1 input=$2
+	shift 2
+	local walls=() rss=0 reads=() writes=() timeouts=0 failures=0
+	local bytes
+	bytes=$(stat -c %s "$input")
+
+	for ((i = 0; i < reps; i++)); do
+		local res
+		res=$(bench/bench_run -t "$timeout" "$input" /dev/null "$@")
+		walls+=("$(field wall_ms "$res")")
+		reads+=("$(field read_syscalls "$res")")
+		writes+=("$(field write_syscalls "$res")")
+		local r
+		r=$(field peak_rss_kb "$res")
+		((r > rss)) && rss=$r
+		[[ $(field timeout "$res") == true ]] && ((timeouts++))
+		[[ $(field exit "$res") != 0 ]] && ((failures++))
+	done
+
+	local min median max
+	min=$(percentile 0 "${walls[@]}")
+	median=$(percentile 50 "${walls[@]}")
+	max=$(percentile 100 "${walls[@]}")
+	printf '    {"corpus": "%s", "size": "%s", "bytes": %s, "stage": "%s", ' \
+		"$kind" "$size" "$bytes" "$stage"
+	printf '"throughput_mb_s": %s, "min_ms": %s, "median_ms": %s, "max_ms": %s, "peak_rss_kb": %s, ' \
+		"$(awk -v b="$bytes" -v ms="$median" 'BEGIN { printf "%.3f", (ms > 0 ? b / 1048576 / (ms / 1000) : 0) }')" \
+		"$min" "$median" "$max" "$rss"
+	printf '"read_syscalls": %s, "write_syscalls": %s, "timeouts": %d, "failures": %d}' \
+		"$(percentile 50 "${reads[@]}")" "$(percentile 50 "${writes[@]}")" "$timeouts" "$failures"
+}
+
+{
+	printf '{\n  "commit": "%s",\n' "$(git rev-parse --short HEAD 2>/dev/null)"
+	printf '  "date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+	printf '  "cpus": %s,\n  "reps": %s,\n' "$(nproc)" "$reps"
+	printf '  "main_flags": "%s",\n  "results": [\n' "$main_flags"
+
+	first=1
+	for size in $sizes; do
+		for kind in $kinds; do
+			corpus=bench/data/$kind-$size-$seed.txt
+			mapped=bench/data/$kind-$size-$seed.mapped
+			if [[ ! -s $corpus ]]; then
+				echo "Generating $corpus" >&2
+				bench/gen_corpus "$kind" "$size" "$seed" >"$corpus"
+			fi
+			if [[ ! -s $mapped || $mapped -ot mapper ]]; then
+				./mapper <"$corpus" >"$mapped"
+			fi
+
+			for stage in pipeline mapper reducer; do
+				echo "Running $stage on $kind-$size" >&2
+				((first)) || printf ',\n'
+				first=0
+				case $stage in
+				pipeline) run_stage pipeline "$corpus" ./main $main_flags ;;
+				mapper) run_stage mapper "$corpus" ./mapper ;;
+				reducer) run_stage reducer "$mapped" ./reducer ;;
+				esac
+			done
+		done
+	done
+	printf '\n  ]\n}\n'
+} >"${out:-/dev/stdout}"
@@ -0,0 +1,69 @@
+#!/bin/bash
+# Mapper scaling: the shuffle to hash_word-partitioned reducers against the
+# shared lock-free table (-M), for 1, 2, 4, ... up to -n mappers. Only ./main
+# writing its output to a file is timed; the output is then checked against
+# the first partitioned run's.
+#
+# Usage: bash bench/scale_mappers.sh [-s size] [-k kind] [-n mappers] [-M slots] [-F "main flags"]
+#   -s  corpus size (default 100M)
+#   -k  corpus kind from gen_corpus (default zipf)
+#   -n  largest mapper count (default 64)
+#   -M  shared table slots (default 1M)
+#   -F  extra flags for both modes, e.g. "-C" or "-A numa"
+
+cd "$(dirname "$0")/.."
+
+size=100M
+kind=zipf
+max_mappers=64
+slots=1M
+flags=""
+
+while getopts "s:k:n:M:F:" opt; do
+	case $opt in
+	s) size=$OPTARG ;;
+	k) kind=$OPTARG ;;
+	n) max_mappers=$OPTARG ;;
+	M) slots=$OPTARG ;;
+	F) flags=$OPTARG ;;
+	*) echo "Usage: $0 [-s size] [-k kind] [-n mappers] [-M slots] [-F main-flags]" >&2; exit 1 ;;
+	esac
+done
+
+make -s main mapper reducer bench/gen_corpus >&2 || exit 1
+corpus=bench/data/$kind-$size-42.txt
+if [[ ! -s $corpus ]]; then
+	mkdir -p bench/data
+	bench/gen_corpus "$kind" "$size" 42 >"$corpus"
+fi
+bytes=$(stat -c %s "$corpus")
+expected=""
+failures=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# run <label> <mappers> <main args...>: time one run and print its throughput
+run() {
+	local label=$1 m=$2
+	shift 2
+	local start ms result status=PASS
+	start=$(date +%s%N)
+	./main -m "$m" "$@" <"$corpus" >"$tmp/out" 2>/dev/null
+	ms=$((($(date +%s%N) - start) / 1000000))
+	result=$(sort "$tmp/out" | md5sum)
+	[[ -z $expected ]] && expected=$result
+	if [[ $result != "$expected" ]]; then
+		status=FAIL
+		((failures++))
+	fi
+	awk -v l="$label" -v m="$m" -v b="$bytes" -v ms="$ms" -v s="$status" 'BEGIN {
+		printf "%s %-11s %2d mapper(s): %6d ms, %7.1f MB/s\n", s, l, m, ms, (ms > 0 ? b / 1048576 / (ms / 1000) : 0) }'
+}
+
+for ((m = 1; m <= max_mappers; m *= 2)); do
+	run partitioned "$m" $flags
+	run shared "$m" -M "$slots" $flags
+done
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,153 @@
+// Built-in jobs and the record codec shared by main, mapper and reducer
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "job.h"
+
+long long fold_sum(long long acc, long long value) {
+    return acc + value;
+}
+
+long long fold_min(long long acc, long long value) {
+    return value < acc ? value : acc;
+}
+
+long long fold_max(long long acc, long long value) {
+    return value > acc ? value : acc;
+}
+
+// Map functions for the log-field jobs
+void map_count(const char *line, size_t len, const struct job_options *opts, emit_fn emit) {
+    char key[MAX_KEY_LEN];
+    const char *k;
+    int klen = find_field(line, len, opts->key_field, &k);
+    if (klen < 0 || klen >= MAX_KEY_LEN) return;
+    memcpy(key, k, klen);
+    key[klen] = '\0';
+    emit(key, klen, 1);
+}
+
+void map_value(const char *line, size_t len, const struct job_options *opts, emit_fn emit) {
+    char key[MAX_KEY_LEN];
+    const char *k, *v;
+    long long value;
+    int klen = find_field(line, len, opts->key_field, &k);
+    int vlen = find_field(line, len, opts->value_field, &v);
+    if (klen < 0 || klen >= MAX_KEY_LEN || vlen < 0 || !parse_value(v, vlen, &value)) return;
+    memcpy(key, k, klen);
+    key[klen] = '\0';
+    emit(key, klen, value);
+}
+
+// Key "field K\tfield V": partitioning only looks before the tab, so all
+// of a key's values meet on one reducer
+void map_pair(const char *line, size_t len, const struct job_options *opts, emit_fn emit) {
+    char key[MAX_KEY_LEN];
+    const char *k, *v;
+    int klen = find_field(line, len, opts->key_field, &k);
+    int vlen = find_field(line, len, opts->value_field, &v);
+    if (klen < 0 || vlen < 0 || klen + 1 + vlen >= MAX_KEY_LEN) return;
+    memcpy(key, k, klen);
+    key[klen] = '\t';
+    memcpy(key + klen + 1, v, vlen);
+    key[klen + 1 + vlen] = '\0';
+    emit(key, klen + 1 + vlen, 1);
+}
+
+void map_bucket(const char *line, size_t len, const struct job_options *opts, emit_fn emit) {
+    char key[MAX_KEY_LEN];
+    const char *v;
+    long long x;
+    int vlen = find_field(line, len, opts->value_field, &v);
+    if (vlen < 0 || !parse_value(v, vlen, &x)) return;
+    long long w = opts->bucket_width;
+    // Round down; the lowest values' bucket would start below LLONG_MIN,
+    // so they are dropped like unparseable ones
+    long long q = x / w - (x % w < 0);
+    if (q < LLONG_MIN / w) return;
+    long long bucket = q * w;
+    int klen = snprintf(key, sizeof(key), "%lld", bucket);
+    emit(key, klen, 1);
+}
+
+const struct codec text_codec = {parse_record, format_record};
+
+// Adding a job means adding a row here
+const struct job jobs[] = {
+    {"wordcount", "occurrences of each word (default)",
+     NULL, 0, fold_sum, &text_codec, 0},
+    {"count", "lines per value of field -k",
+     map_count, JOB_KEY_FIELD, fold_sum, &text_codec, 0},
+    {"sum", "sum of field -v per value of field -k",
+     map_value, JOB_KEY_FIELD | JOB_VALUE_FIELD, fold_sum, &text_codec, 0},
+    {"min", "minimum of field -v per value of field -k",
+     map_value, JOB_KEY_FIELD | JOB_VALUE_FIELD, fold_min, &text_codec, 0},
+    {"max", "maximum of field -v per value of field -k",
+     map_value, JOB_KEY_FIELD | JOB_VALUE_FIELD, fold_max, &text_codec, 0},
+    {"distinct", "distinct values of field -v per value of field -k",
+     map_pair, JOB_KEY_FIELD | JOB_VALUE_FIELD, fold_sum, &text_codec, 1},
+    {"histogram", "lines per -w wide bucket of field -v",
+     map_bucket, JOB_VALUE_FIELD | JOB_BUCKET_WIDTH, fold_sum, &text_codec, 0},
+};
+
+#define NUM_JOBS (sizeof(jobs) / sizeof(jobs[0]))
+
+const struct job *find_job(const char *name) {
+    for (size_t i = 0; i < NUM_JOBS; i++) {
+        if (strcmp(jobs[i].name, name) == 0) return &jobs[i];
+    }
+    return NULL;
+}
+
+void list_jobs(FILE *out) {
+    for (size_t i = 0; i < NUM_JOBS; i++) {
+        fprintf(out, "  %-10s %s\n", jobs[i].name, jobs[i].description);
+    }
+}
+
+int parse_record(char *line, char **key, long long *value) {
+    char *space = strrchr(line, ' ');
+    if (!space || space == line) return 0;
+
+    char *end;
+    errno = 0;
+    *value = strtoll(space + 1, &end, 10);
+    if (end == space + 1 || errno == ERANGE) return 0;
+
+    *space = '\0';
+    *key = line;
+    return 1;
+}
+
+int format_record(char *buf, size_t size, const char *key, long long value) {
+    return snprintf(buf, size, "%s %lld\n", key, value);
+}
+
+int find_field(const char *line, size_t len, int n, const char **start) {
+    size_t i = 0;
+    for (int field = 1; ; field++) {
+        while (i < len && isspace((unsigned char)line[i])) i++;
+        if (i == len) return -1;
+        size_t begin = i;
+        while (i < len && !isspace((unsigned char)line[i])) i++;
+        if (field == n) {
+            *start = line + begin;
+            return i - begin;
+        }
+    }
+}
+
+int parse_value(const char *s, int len, long long *value) {
+    char buf[32];
+    char *end;
+    if (len <= 0 || len >= (int)sizeof(buf)) return 0;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    errno = 0;
+    *value = strtoll(buf, &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
@@ -0,0 +1,72 @@
+// Job table shared by main, mapper and reducer.
+//
+// A job is a row of functions: how the mapper turns an input line into
+// (key, value) records, how values for the same key are folded together,
+// and the codec that writes records and output lines as text and reads them
+// back. The fold is used by the mapper's combiner (-C), the shared table
+// (-M) and the reducer, so it must be associative and commutative. Values
+// are signed 64-bit integers; a key may contain a tab, and only the part
+// before the first tab decides which reducer gets the record.
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define MAX_KEY_LEN 256          // keys this long or longer are dropped
+
+// Field options for the log-field jobs (1-based, whitespace separated)
+struct job_options {
+    int key_field;
+    int value_field;
+    long long bucket_width;
+};
+
+// Which field options a job's map function reads; main rejects the others
+#define JOB_KEY_FIELD    1       // -k
+#define JOB_VALUE_FIELD  2       // -v
+#define JOB_BUCKET_WIDTH 4       // -w
+
+// Where a map function sends its records; key[len] must be '\0'
+typedef void (*emit_fn)(const char *key, int len, long long value);
+
+// Text form of a record, used between the mapper, main and the reducers
+// and for the final output lines
+struct codec {
+    // Split a line (without its newline) in place; 0 if it isn't a record
+    int (*parse)(char *line, char **key, long long *value);
+    // Write the line with its newline; returns its length like snprintf
+    int (*format)(char *buf, size_t size, const char *key, long long value);
+};
+
+struct job {
+    const char *name;
+    const char *description;
+    // Map one input line (without its newline) to records. NULL selects the
+    // mapper's streaming word tokenizer, which works on raw read() buffers
+    // instead of lines and is where the word filters and Unicode folding live.
+    void (*map)(const char *line, size_t len, const struct job_options *opts, emit_fn emit);
+    int options;                 // JOB_* bits
+    long long (*fold)(long long acc, long long value);
+    const struct codec *codec;
+    // Reducer output collapses "key\tvalue" entries into "key <n distinct>"
+    int distinct;
+};
+
+const struct job *find_job(const char *name);
+void list_jobs(FILE *out);
+
+// The sum fold, which the shared table (-M) recognises to add atomically
+long long fold_sum(long long acc, long long value);
+
+// The "<key> <value>" codec every built-in job uses: parse splits at the
+// last space
+int parse_record(char *line, char **key, long long *value);
+int format_record(char *buf, size_t size, const char *key, long long value);
+
+// Field helpers for the log-field map functions: find field n (1-based) of
+// a line; returns its length and stores its start, or -1 if it is missing
+int find_field(const char *line, size_t len, int n, const char **start);
+int parse_value(const char *s, int len, long long *value);
+
+#endif
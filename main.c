@@ -1,6 +1,36 @@
-// Compile: gcc -O2 main.c -o main
-// Run: ./main < input.txt > output.txt
+// Compile: gcc -O2 main.c job.c table.c -o main -lm
+// Run: ./main [-j job] [-k field] [-v field] [-w width] [-m n] [-r n] [-t n] [-H hosts]
+//            [-s stopfile] [-l min] [-L max] [-p prefix,...] [-x regex] [-n min]
+//            [-i previous] [-A numa|cpulist] [-M slots] [-D socket] [-C] [-S] [-V] [-d] [-f]
+//            < input.txt > output.txt
+//      ./main -U socket < input.txt > output.txt
+//   -j  job to run (default wordcount); an unknown name lists the jobs
+//   -k/-v/-w  key field, value field and bucket width for the log-field jobs
+//   -s/-l/-L/-p/-x  word filters applied in the mappers (see mapper.c), so
+//       dropped words never reach the shuffle
+//   -n  only output keys whose final value is at least min
+//   -i  incremental recount: merge the input into a previous result file of
+//       the same job (loaded into the reducers) instead of starting empty
+//   -M  no shuffle or reducers: the mappers fold straight into one lock-free
+//       table of this many slots (e.g. 1M) in shared memory (table.h), and
+//       main prints it sorted at the end
+//   -D  daemon: keep the mappers and reducers running and serve jobs sent
+//       to this Unix socket one at a time, all with the options given here
+//   -U  client: send stdin as a job to the daemon on this socket
+//   -C  combine records inside each mapper before the shuffle
+//   -S  don't send reducers table sizing hints
+//   -V  log every record relayed to a reducer on stderr (one write each, slow)
+//   -m/-r  number of mappers and reducers (default 4 and 2, at most 64)
+//   -t  threads each reducer uses to sort and format its output
+//   -A  pin the coordinator to its own core and the tasks to the NUMA nodes
+//       ("numa") or one core each from a cpulist such as "0-7,16-23"
+//   -H  run the tasks on worker agents (./worker) at host:port[,host:port...]
+//       instead of as local children; task i goes to worker i % count
+//   -d  dictionary-encode the shuffle: words travel once, records as integer ids
+//   -f  fault tolerant: restart crashed mappers/reducers and redo only the
+//       input chunks / shuffle records they lost
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,25 +40,169 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <signal.h>
+#include <sched.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <regex.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
-#define NUM_MAPPERS 4
+#include "job.h"
+#include "table.h"
+
+#define NUM_MAPPERS 4                   // defaults for -m and -r
 #define NUM_REDUCERS 2
+#define MAX_MAPPERS 64
+#define MAX_REDUCERS 64
+#define MAX_WORKERS 64
+#define MAX_NODES 64
 #define MAX_LINE 1024
 #define BUFFER_SIZE 4096
+#define MAX_WORD_LEN 256
+
+// Fault-tolerant mode (-f)
+#define CHUNK_SIZE (64 * 1024)          // input handed to a mapper per frame
+#define MAX_INFLIGHT 2                  // unacknowledged frames per mapper
+#define MAX_ATTEMPTS 3                  // restarts before giving up
+#define CKPT_BYTES (4 * 1024 * 1024)    // shuffle bytes between reducer checkpoints
+
+int num_mappers = NUM_MAPPERS;
+int num_reducers = NUM_REDUCERS;
+int dict_mode = 0;
+int ft_mode = 0;
+int combine_mode = 0;
+int size_hints = 1;
+int verbose = 0;
+const char *job_name = "wordcount";
+const struct job *job;
+const char *key_field, *value_field, *bucket_width;
+const char *reducer_threads;
+const char *min_count;
+
+// Mapper word filters, passed through as given
+struct Filter {
+    const char *flag;
+    const char *value;
+} filters[] = {{"-s", NULL}, {"-l", NULL}, {"-L", NULL}, {"-p", NULL}, {"-x", NULL}};
+#define NUM_FILTERS (int)(sizeof(filters) / sizeof(filters[0]))
+char *workers[MAX_WORKERS];
+int num_workers = 0;
+const char *daemon_path;
+const char *previous_path;
+const char *placement;
+uint64_t shared_slots = 0;
+struct table table;
+char table_fd[16];
+
+int mapper_in[MAX_MAPPERS], mapper_out[MAX_MAPPERS];
+int reducer_in[MAX_REDUCERS], reducer_out[MAX_REDUCERS];
+pid_t mapper_pids[MAX_MAPPERS], reducer_pids[MAX_REDUCERS];
 
 void error_exit(const char *msg) {
     perror(msg);
     exit(1);
 }
 
+// Partition on the part of the key before the first tab, so every
+// "key\tvalue" record of a distinct job lands on the same reducer
 unsigned int hash_word(const char *word, int num_reducers) {
     unsigned int hash = 0;
-    for (int i = 0; word[i]; i++) {
+    for (int i = 0; word[i] && word[i] != '\t'; i++) {
         hash = hash * 31 + word[i];
     }
     return hash % num_reducers;
 }
 
+// String hash used for the dictionary tables (FNV-1a)
+unsigned int dict_hash(const char *word) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; word[i]; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Per-reducer word -> id table. Each reducer gets its own dense id space so
+// it can index its counts directly instead of comparing strings.
+struct Dict {
+    char **words;
+    int *ids;
+    int cap;
+    int size;
+};
+
+// Where a mapper-local id goes: which reducer, and that reducer's id
+struct Route {
+    int rid;
+    int gid;
+};
+
+struct RouteTable {
+    struct Route *routes;
+    int cap;
+};
+
+struct Dict reducer_dicts[MAX_REDUCERS];
+struct RouteTable mapper_routes[MAX_MAPPERS];
+
+void dict_grow(struct Dict *d) {
+    int new_cap = d->cap ? d->cap * 2 : 1024;
+    char **words = calloc(new_cap, sizeof(char *));
+    int *ids = malloc(new_cap * sizeof(int));
+    if (!words || !ids) error_exit("malloc dict");
+
+    for (int i = 0; i < d->cap; i++) {
+        if (!d->words[i]) continue;
+        unsigned int h = dict_hash(d->words[i]) & (new_cap - 1);
+        while (words[h]) h = (h + 1) & (new_cap - 1);
+        words[h] = d->words[i];
+        ids[h] = d->ids[i];
+    }
+    free(d->words);
+    free(d->ids);
+    d->words = words;
+    d->ids = ids;
+    d->cap = new_cap;
+}
+
+// Look up a word, assigning the next id if it is new
+int dict_intern(struct Dict *d, const char *word, int *is_new) {
+    if ((d->size + 1) * 2 > d->cap) dict_grow(d);
+
+    unsigned int h = dict_hash(word) & (d->cap - 1);
+    while (d->words[h]) {
+        if (strcmp(d->words[h], word) == 0) {
+            *is_new = 0;
+            return d->ids[h];
+        }
+        h = (h + 1) & (d->cap - 1);
+    }
+    d->words[h] = strdup(word);
+    if (!d->words[h]) error_exit("strdup");
+    d->ids[h] = d->size++;
+    *is_new = 1;
+    return d->ids[h];
+}
+
+void route_set(struct RouteTable *t, int id, int rid, int gid) {
+    if (id >= t->cap) {
+        int new_cap = t->cap ? t->cap : 1024;
+        while (new_cap <= id) new_cap *= 2;
+        t->routes = realloc(t->routes, new_cap * sizeof(struct Route));
+        if (!t->routes) error_exit("realloc routes");
+        for (int i = t->cap; i < new_cap; i++) t->routes[i].rid = -1;
+        t->cap = new_cap;
+    }
+    t->routes[id].rid = rid;
+    t->routes[id].gid = gid;
+}
+
 // Write all bytes to a file descriptor
 ssize_t write_all(int fd, const char *buf, size_t count) {
     size_t bytes_written = 0;
@@ -44,249 +218,1750 @@ ssize_t write_all(int fd, const char *buf, size_t count) {
     return bytes_written;
 }
 
-int main() {
-    fprintf(stderr, "Starting main program\n");
-    
-    int mapper_stdin[NUM_MAPPERS][2];
-    int mapper_stdout[NUM_MAPPERS][2];
-    int reducer_stdin[NUM_REDUCERS][2];
-    int reducer_stdout[NUM_REDUCERS][2];
+void send_to_reducer(int rid, const char *buf, size_t len);
 
-    pid_t mapper_pids[NUM_MAPPERS], reducer_pids[NUM_REDUCERS];
+// Table sizing hints (off with -S). main keeps a HyperLogLog sketch of the
+// keys it routes to each reducer (dictionary mode counts them exactly) and
+// sends "#<n>" when a reducer's key count has grown well past its last
+// hint, so the reducer sizes its table and key arena once per hint instead
+// of once per doubling.
+#define HLL_BITS 12
+#define HLL_REGS (1 << HLL_BITS)
+#define HINT_MIN 4096                   // smaller tables aren't worth a hint
 
-    // Create pipes for mappers
-    fprintf(stderr, "Creating mapper pipes\n");
-    for (int i = 0; i < NUM_MAPPERS; i++) {
-        if (pipe(mapper_stdin[i]) < 0 || pipe(mapper_stdout[i]) < 0)
-            error_exit("pipe for mapper");
+struct Sketch {
+    unsigned char regs[HLL_REGS];
+    double sum;                         // sum of 2^-reg over all registers
+    int zeros;
+    long hinted;                        // estimate behind the last hint
+};
+
+struct Sketch sketches[MAX_REDUCERS];
+
+void init_sketches() {
+    for (int i = 0; i < num_reducers; i++) {
+        sketches[i].sum = HLL_REGS;
+        sketches[i].zeros = HLL_REGS;
     }
+}
 
-    // Create pipes for reducers
-    fprintf(stderr, "Creating reducer pipes\n");
-    for (int i = 0; i < NUM_REDUCERS; i++) {
-        if (pipe(reducer_stdin[i]) < 0 || pipe(reducer_stdout[i]) < 0)
-            error_exit("pipe for reducer");
+long sketch_estimate(const struct Sketch *sk) {
+    double m = HLL_REGS;
+    double e = 0.7213 / (1 + 1.079 / m) * m * m / sk->sum;
+    if (e <= 2.5 * m && sk->zeros > 0) {
+        e = m * log(m / sk->zeros);     // linear counting for small sets
     }
+    return (long)e;
+}
 
-    // Start mapper processes
-    fprintf(stderr, "Starting mapper processes\n");
-    for (int i = 0; i < NUM_MAPPERS; i++) {
-        pid_t pid = fork();
-        if (pid < 0) error_exit("fork mapper");
-
-        if (pid == 0) { // Child process (mapper)
-            fprintf(stderr, "Mapper %d starting\n", i);
-            // Close unused pipe ends
-            close(mapper_stdin[i][1]);
-            close(mapper_stdout[i][0]);
-            
-            // Close all other pipes
-            for (int j = 0; j < NUM_MAPPERS; j++) {
-                if (j != i) {
-                    close(mapper_stdin[j][0]);
-                    close(mapper_stdin[j][1]);
-                    close(mapper_stdout[j][0]);
-                    close(mapper_stdout[j][1]);
-                }
+// A reducer now has about n keys. Once that has grown 1.5x since the last
+// hint, hint 1.5n: room until the next hint, without doubling's slack.
+void note_keys(int rid, long n) {
+    struct Sketch *sk = &sketches[rid];
+    if (n < HINT_MIN || n < sk->hinted + sk->hinted / 2) return;
+    sk->hinted = n;
+
+    char msg[32];
+    int len = snprintf(msg, sizeof(msg), "#%ld\n", n + n / 2);
+    send_to_reducer(rid, msg, len);
+}
+
+void sketch_add(int rid, const char *key) {
+    // FNV-1a 64 with a final mix, so every bit is usable
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; key[i]; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    struct Sketch *sk = &sketches[rid];
+    unsigned int reg = h >> (64 - HLL_BITS);
+    uint64_t rest = h << HLL_BITS;
+    int rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1;
+    if (rank <= sk->regs[reg]) return;
+
+    if (sk->regs[reg] == 0) sk->zeros--;
+    sk->sum += 1.0 / (1ULL << rank) - 1.0 / (1ULL << sk->regs[reg]);
+    sk->regs[reg] = rank;
+    note_keys(rid, sketch_estimate(sk));
+}
+
+// Forward one complete mapper output line to the reducer owning its word
+void relay_record(int mapper, char *line) {
+    char outbuf[512];
+    long long count;
+    int len;
+
+    if (!dict_mode) {
+        char *word;
+        if (job->codec->parse(line, &word, &count) && strlen(word) < MAX_WORD_LEN) {
+            if (verbose) fprintf(stderr, "Mapper %d output: %s %lld\n", mapper, word, count);
+            int rid = hash_word(word, num_reducers);
+            if (size_hints) sketch_add(rid, word);
+            len = job->codec->format(outbuf, sizeof(outbuf), word, count);
+            send_to_reducer(rid, outbuf, len);
+        }
+        return;
+    }
+
+    // Dictionary definition: "= <id> <word>"
+    if (line[0] == '=' && line[1] == ' ') {
+        char *end;
+        long id = strtol(line + 2, &end, 10);
+        if (end == line + 2 || *end != ' ' || id < 0) return;
+        const char *w = end + 1;
+        if (strlen(w) >= MAX_WORD_LEN) {
+            // Same limit as the text path; records for this id get dropped
+            route_set(&mapper_routes[mapper], id, -1, -1);
+            return;
+        }
+
+        int rid = hash_word(w, num_reducers);
+        int is_new;
+        int gid = dict_intern(&reducer_dicts[rid], w, &is_new);
+        if (is_new) {
+            if (size_hints) note_keys(rid, reducer_dicts[rid].size);
+            len = snprintf(outbuf, sizeof(outbuf), "= %d %s\n", gid, w);
+            send_to_reducer(rid, outbuf, len);
+        }
+        route_set(&mapper_routes[mapper], id, rid, gid);
+        return;
+    }
+
+    // Encoded record: "<id> <count>"
+    int id;
+    if (sscanf(line, "%d %lld", &id, &count) != 2) return;
+    struct RouteTable *t = &mapper_routes[mapper];
+    if (id < 0 || id >= t->cap || t->routes[id].rid < 0) return;
+
+    if (verbose) fprintf(stderr, "Mapper %d output: #%d %lld\n", mapper, id, count);
+    len = snprintf(outbuf, sizeof(outbuf), "%d %lld\n", t->routes[id].gid, count);
+    send_to_reducer(t->routes[id].rid, outbuf, len);
+}
+
+// Incremental recount (-i): stream a previous result file into the
+// reducers as if a mapper had emitted each "<key> <value>" line, routed by
+// hash_word like any record. The job's fold then merges the new input into
+// the old totals, so only the new input goes through the mappers.
+void load_previous(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) error_exit(path);
+
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    long records = 0;
+    while ((n = getline(&line, &line_cap, f)) > 0) {
+        char outbuf[512];
+        char *key;
+        long long value;
+        int len;
+
+        if (line[n - 1] == '\n') line[n - 1] = '\0';
+        if (!job->codec->parse(line, &key, &value) || strlen(key) >= MAX_WORD_LEN) continue;
+        if (shared_slots) {
+            // Mappers may be folding into the table already; that's fine
+            if (!table_add(&table, key, strlen(key), value, job->fold)) break;
+            records++;
+            continue;
+        }
+        int rid = hash_word(key, num_reducers);
+
+        if (dict_mode) {
+            int is_new;
+            int gid = dict_intern(&reducer_dicts[rid], key, &is_new);
+            if (is_new) {
+                if (size_hints) note_keys(rid, reducer_dicts[rid].size);
+                len = snprintf(outbuf, sizeof(outbuf), "= %d %s\n", gid, key);
+                send_to_reducer(rid, outbuf, len);
             }
-            for (int j = 0; j < NUM_REDUCERS; j++) {
-                close(reducer_stdin[j][0]);
-                close(reducer_stdin[j][1]);
-                close(reducer_stdout[j][0]);
-                close(reducer_stdout[j][1]);
+            len = snprintf(outbuf, sizeof(outbuf), "%d %lld\n", gid, value);
+        } else {
+            if (size_hints) sketch_add(rid, key);
+            len = job->codec->format(outbuf, sizeof(outbuf), key, value);
+        }
+        send_to_reducer(rid, outbuf, len);
+        records++;
+    }
+    free(line);
+    fclose(f);
+    fprintf(stderr, "Loaded %ld records from %s\n", records, path);
+}
+
+// An integer option: the whole value must be a number from lo to hi
+long long parse_option(const char *flag, const char *s, long long lo, long long hi) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE || v < lo || v > hi) {
+        fprintf(stderr, "Bad %s value: %s\n", flag, s);
+        exit(1);
+    }
+    return v;
+}
+
+// -k/-v/-w, checked up front like the filters below. A job rejects the
+// ones its map function doesn't read instead of ignoring them.
+void check_job_options() {
+    const struct {
+        const char *flag;
+        const char *value;
+        int option;
+        long long max;
+    } options[] = {
+        {"-k", key_field, JOB_KEY_FIELD, INT_MAX},
+        {"-v", value_field, JOB_VALUE_FIELD, INT_MAX},
+        {"-w", bucket_width, JOB_BUCKET_WIDTH, LLONG_MAX},
+    };
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        if (!options[i].value) continue;
+        if (!(job->options & options[i].option)) {
+            fprintf(stderr, "%s doesn't apply to the %s job\n", options[i].flag, job->name);
+            exit(1);
+        }
+        parse_option(options[i].flag, options[i].value, 1, options[i].max);
+    }
+}
+
+// A bad filter would fail every mapper at once, so check the filters before
+// any task starts. Under -H the stop file is read on the workers' hosts.
+void check_filters() {
+    long long min_len = 0, max_len = 0;
+    for (int f = 0; f < NUM_FILTERS; f++) {
+        const char *value = filters[f].value;
+        if (!value) continue;
+        if (job->map) {
+            fprintf(stderr, "%s only applies to word jobs, not %s\n", filters[f].flag, job->name);
+            exit(1);
+        }
+        if (strcmp(filters[f].flag, "-s") == 0 && !num_workers) {
+            FILE *stop = fopen(value, "r");
+            if (!stop) error_exit(value);
+            fclose(stop);
+        }
+        if (strcmp(filters[f].flag, "-l") == 0) min_len = parse_option("-l", value, 0, INT_MAX);
+        if (strcmp(filters[f].flag, "-L") == 0) max_len = parse_option("-L", value, 1, INT_MAX);
+        if (strcmp(filters[f].flag, "-x") == 0) {
+            regex_t re;
+            int err = regcomp(&re, value, REG_EXTENDED | REG_NOSUB);
+            if (err) {
+                char msg[256];
+                regerror(err, &re, msg, sizeof(msg));
+                fprintf(stderr, "Bad regex: %s\n", msg);
+                exit(1);
             }
-            
-            // Redirect stdin/stdout
-            if (dup2(mapper_stdin[i][0], STDIN_FILENO) < 0) error_exit("dup2 stdin");
-            if (dup2(mapper_stdout[i][1], STDOUT_FILENO) < 0) error_exit("dup2 stdout");
-            
-            // Close original pipe ends
-            close(mapper_stdin[i][0]);
-            close(mapper_stdout[i][1]);
-            
-            execlp("./mapper", "./mapper", NULL);
-            error_exit("exec mapper");
-        }
-        
-        mapper_pids[i] = pid;
-    }
-
-    // Start reducer processes
-    fprintf(stderr, "Starting reducer processes\n");
-    for (int i = 0; i < NUM_REDUCERS; i++) {
-        pid_t pid = fork();
-        if (pid < 0) error_exit("fork reducer");
-
-        if (pid == 0) { // Child process (reducer)
-            fprintf(stderr, "Reducer %d starting\n", i);
-            // Close unused pipe ends
-            close(reducer_stdin[i][1]);
-            close(reducer_stdout[i][0]);
-            
-            // Close all other pipes
-            for (int j = 0; j < NUM_MAPPERS; j++) {
-                close(mapper_stdin[j][0]);
-                close(mapper_stdin[j][1]);
-                close(mapper_stdout[j][0]);
-                close(mapper_stdout[j][1]);
+            regfree(&re);
+        }
+    }
+    if (max_len && max_len < min_len) {
+        fprintf(stderr, "-L %lld is smaller than -l %lld\n", max_len, min_len);
+        exit(1);
+    }
+    // -n applies to every job, in the reducers or the shared table
+    if (min_count) parse_option("-n", min_count, LLONG_MIN, LLONG_MAX);
+}
+
+/* ---------------------------------------------------------------------- */
+/* CPU placement (-A)                                                      */
+/* ---------------------------------------------------------------------- */
+
+// Each task's CPU set, fixed before the first start so a restarted task
+// comes back where it was. A child is pinned before exec, so everything it
+// allocates is first touched there and, under the kernel's default local
+// policy, lands on the memory of that CPU's NUMA node.
+cpu_set_t mapper_cpus[MAX_MAPPERS], reducer_cpus[MAX_REDUCERS];
+int pinned = 0;
+
+// Parse a kernel cpulist ("0-3,8,10-11") into set; returns the CPU count
+// or -1 if it's malformed
+int parse_cpulist(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return -1;
+        for (long c = lo; c <= hi; c++) CPU_SET(c, set);
+        s = end;
+        if (*s == ',') s++;
+        else if (*s && *s != '\n') return -1;
+    }
+    return CPU_COUNT(set);
+}
+
+// The NUMA nodes' CPUs from sysfs, limited to the CPUs this process may use.
+// Memory-only nodes are skipped; a machine without the node directory is
+// one node.
+int load_nodes(cpu_set_t nodes[], const cpu_set_t *allowed) {
+    int count = 0;
+    for (int n = 0; n < MAX_NODES; n++) {
+        char path[64], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        int ok = fgets(list, sizeof(list), f) != NULL;
+        fclose(f);
+        if (!ok || parse_cpulist(list, &nodes[count]) < 0) continue;
+        CPU_AND(&nodes[count], &nodes[count], allowed);
+        if (CPU_COUNT(&nodes[count]) > 0) count++;
+    }
+    if (count == 0) {
+        nodes[0] = *allowed;
+        count = 1;
+    }
+    return count;
+}
+
+int first_cpu(const cpu_set_t *set) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, set)) return c;
+    }
+    return -1;
+}
+
+// The CPU after cpu in set, wrapping around
+int next_cpu(const cpu_set_t *set, int cpu) {
+    for (int c = cpu + 1; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, set)) return c;
+    }
+    return first_cpu(set);
+}
+
+// Plan every task's CPUs and pin the coordinator. The coordinator takes the
+// first CPU to itself whenever there is another one left for the tasks.
+//   "numa"   tasks go round-robin over the NUMA nodes and may run on any CPU
+//            of their node; reducer i is on node i % nodes, so its table and
+//            its finalize threads stay on that node, one thread per CPU of it
+//   cpulist  one core per task from the list: reducers first, then mappers,
+//            wrapping around when there are more tasks than cores
+void plan_placement(const char *spec) {
+    cpu_set_t allowed, nodes[MAX_NODES], coordinator;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) error_exit("sched_getaffinity");
+
+    int num_nodes;
+    if (strcmp(spec, "numa") == 0) {
+        num_nodes = load_nodes(nodes, &allowed);
+    } else {
+        if (parse_cpulist(spec, &nodes[0]) < 0) {
+            fprintf(stderr, "Bad CPU list: %s\n", spec);
+            exit(1);
+        }
+        CPU_AND(&nodes[0], &nodes[0], &allowed);
+        if (CPU_COUNT(&nodes[0]) == 0) {
+            fprintf(stderr, "None of the CPUs in %s are available\n", spec);
+            exit(1);
+        }
+        num_nodes = 1;
+    }
+
+    int cpu = first_cpu(&nodes[0]);
+    CPU_ZERO(&coordinator);
+    CPU_SET(cpu, &coordinator);
+    if (CPU_COUNT(&nodes[0]) > 1 || num_nodes > 1) CPU_CLR(cpu, &nodes[0]);
+    if (CPU_COUNT(&nodes[0]) == 0) nodes[0] = nodes[--num_nodes];
+    if (sched_setaffinity(0, sizeof(coordinator), &coordinator) < 0) error_exit("sched_setaffinity");
+
+    if (strcmp(spec, "numa") == 0) {
+        for (int i = 0; i < num_reducers; i++) reducer_cpus[i] = nodes[i % num_nodes];
+        for (int i = 0; i < num_mappers; i++) mapper_cpus[i] = nodes[i % num_nodes];
+        fprintf(stderr, "Coordinator on CPU %d, tasks over %d NUMA node(s)\n", cpu, num_nodes);
+    } else {
+        int c = first_cpu(&nodes[0]);
+        for (int i = 0; i < num_reducers; i++, c = next_cpu(&nodes[0], c)) {
+            CPU_ZERO(&reducer_cpus[i]);
+            CPU_SET(c, &reducer_cpus[i]);
+        }
+        for (int i = 0; i < num_mappers; i++, c = next_cpu(&nodes[0], c)) {
+            CPU_ZERO(&mapper_cpus[i]);
+            CPU_SET(c, &mapper_cpus[i]);
+        }
+        fprintf(stderr, "Coordinator on CPU %d, tasks on %d core(s)\n", cpu, CPU_COUNT(&nodes[0]));
+    }
+    pinned = 1;
+}
+
+// Fork a child running argv with stdin/stdout on fresh pipes, pinned to
+// cpus unless that's NULL. Every pipe is close-on-exec, so a child only
+// keeps the two ends dup'ed onto 0 and 1 and a restarted child never holds
+// another task's pipes open.
+pid_t spawn(char *const argv[], const cpu_set_t *cpus, int *in_fd, int *out_fd) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0)
+        error_exit("pipe");
+
+    pid_t pid = fork();
+    if (pid < 0) error_exit("fork");
+
+    if (pid == 0) {
+        if (dup2(in[0], STDIN_FILENO) < 0) error_exit("dup2 stdin");
+        if (dup2(out[1], STDOUT_FILENO) < 0) error_exit("dup2 stdout");
+        // A CPU taken offline since planning isn't worth failing the job
+        if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus) < 0) perror("sched_setaffinity");
+        execvp(argv[0], argv);
+        error_exit("exec");
+    }
+
+    close(in[0]);
+    close(out[1]);
+    *in_fd = in[1];
+    *out_fd = out[0];
+    return pid;
+}
+
+// Connect to the worker agent at "host:port"
+int connect_worker(const char *addr) {
+    char host[256];
+    const char *colon = strrchr(addr, ':');
+    if (!colon || colon - addr >= (int)sizeof(host)) {
+        fprintf(stderr, "Bad worker address: %s\n", addr);
+        exit(1);
+    }
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &res);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", addr, gai_strerror(err));
+        exit(1);
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) error_exit(addr);
+
+    // Frame acknowledgements are tiny; don't let Nagle hold them back
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Run argv on worker task % num_workers. The first line names the program
+// and its arguments; after it the connection carries the task's stdin and
+// stdout exactly as the pipes would.
+void connect_task(int task, char *const argv[], int *in_fd, int *out_fd) {
+    // Same limit as the worker's MAX_HELLO, newline included
+    char hello[512];
+    const char *prog = strrchr(argv[0], '/');
+    size_t len = snprintf(hello, sizeof(hello), "%s", prog ? prog + 1 : argv[0]);
+    for (int i = 1; argv[i] && len < sizeof(hello); i++) {
+        // The handshake is split on spaces
+        if (strchr(argv[i], ' ')) {
+            fprintf(stderr, "Worker task arguments cannot contain spaces: %s\n", argv[i]);
+            exit(1);
+        }
+        len += snprintf(hello + len, sizeof(hello) - len, " %s", argv[i]);
+    }
+    if (len < sizeof(hello)) len += snprintf(hello + len, sizeof(hello) - len, "\n");
+    if (len >= sizeof(hello)) {
+        fprintf(stderr, "Worker task arguments are longer than %zu bytes\n", sizeof(hello) - 1);
+        exit(1);
+    }
+
+    int fd = connect_worker(workers[task % num_workers]);
+    if (write_all(fd, hello, len) < (ssize_t)len) error_exit("worker handshake");
+
+    *in_fd = fd;
+    *out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (*out_fd < 0) error_exit("dup");
+}
+
+// End a task's input. A worker connection carries both directions on one
+// socket, so shut down the sending side to deliver EOF; on a pipe the
+// shutdown fails harmlessly.
+void close_input(int fd) {
+    shutdown(fd, SHUT_WR);
+    close(fd);
+}
+
+// Exit status of a task whose output just ended. Remote tasks have no pid:
+// the worker resets the connection when its task fails, so a read error
+// counts as a failure and a clean EOF as exit code 0.
+int wait_task(pid_t pid, int eof) {
+    int status = eof ? 0 : W_EXITCODE(1, 0);
+    if (pid > 0) waitpid(pid, &status, 0);
+    return status;
+}
+
+char ckpt_dir[256];
+
+void ckpt_path(int i, char *path, size_t size) {
+    snprintf(path, size, "%s/reducer%d.ckpt", ckpt_dir, i);
+}
+
+void start_mapper(int i) {
+    char *argv[16 + 2 * NUM_FILTERS];
+    int argc = 0;
+    argv[argc++] = "./mapper";
+    argv[argc++] = "-j";
+    argv[argc++] = (char *)job_name;
+    if (key_field) {
+        argv[argc++] = "-k";
+        argv[argc++] = (char *)key_field;
+    }
+    if (value_field) {
+        argv[argc++] = "-v";
+        argv[argc++] = (char *)value_field;
+    }
+    if (bucket_width) {
+        argv[argc++] = "-w";
+        argv[argc++] = (char *)bucket_width;
+    }
+    for (int f = 0; f < NUM_FILTERS; f++) {
+        if (filters[f].value) {
+            argv[argc++] = (char *)filters[f].flag;
+            argv[argc++] = (char *)filters[f].value;
+        }
+    }
+    if (combine_mode) argv[argc++] = "-C";
+    if (dict_mode) argv[argc++] = "-d";
+    if (ft_mode || daemon_path) argv[argc++] = "-f";
+    if (shared_slots) {
+        argv[argc++] = "-M";
+        argv[argc++] = table_fd;
+    }
+    argv[argc] = NULL;
+
+    fprintf(stderr, "Mapper %d starting\n", i);
+    if (num_workers) {
+        connect_task(i, argv, &mapper_in[i], &mapper_out[i]);
+        mapper_pids[i] = 0;
+    } else {
+        mapper_pids[i] = spawn(argv, pinned ? &mapper_cpus[i] : NULL, &mapper_in[i], &mapper_out[i]);
+    }
+}
+
+void start_reducer(int i) {
+    char path[PATH_MAX];
+    char *argv[11];
+    int argc = 0;
+    argv[argc++] = "./reducer";
+    argv[argc++] = "-j";
+    argv[argc++] = (char *)job_name;
+    if (reducer_threads) {
+        argv[argc++] = "-t";
+        argv[argc++] = (char *)reducer_threads;
+    }
+    if (min_count) {
+        argv[argc++] = "-n";
+        argv[argc++] = (char *)min_count;
+    }
+    if (dict_mode) argv[argc++] = "-d";
+    // Checkpoints go to this host's disk, so remote reducers run without
+    // them and a restart replays the reducer's whole log instead
+    if (ft_mode && !num_workers) {
+        ckpt_path(i, path, sizeof(path));
+        argv[argc++] = "-c";
+        argv[argc++] = path;
+    }
+    argv[argc] = NULL;
+
+    fprintf(stderr, "Reducer %d starting\n", i);
+    if (num_workers) {
+        connect_task(i, argv, &reducer_in[i], &reducer_out[i]);
+        reducer_pids[i] = 0;
+    } else {
+        reducer_pids[i] = spawn(argv, pinned ? &reducer_cpus[i] : NULL, &reducer_in[i], &reducer_out[i]);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Fault-tolerant mode                                                     */
+/* ---------------------------------------------------------------------- */
+
+// A slice of the input, framed as "<len>\n<lines>" for the mapper. It stays
+// queued on its mapper until the mapper acknowledges it with a "." line.
+struct Chunk {
+    char *buf;
+    char *frame;
+    size_t len;
+    int seq;
+    int attempts;
+    struct Chunk *next;
+};
+
+struct MapperState {
+    struct Chunk *head, *tail;   // unacknowledged frames, oldest first
+    struct Chunk *sending;       // first frame not completely written yet
+    size_t send_off;
+    int inflight;
+    char *staged;                // output for the oldest frame, held until "."
+    size_t staged_len, staged_cap;
+    char pending[BUFFER_SIZE];
+    size_t pending_len;
+    int attempts;
+    int exited, status;
+    int finished;
+};
+
+// Shuffle bytes sent to a reducer after checkpoint request <epoch>
+struct LogSegment {
+    int epoch;
+    char *data;
+    size_t len, cap;
+    struct LogSegment *next;
+};
+
+struct ReducerState {
+    struct LogSegment *log_head, *log_tail;
+    int epoch;
+    size_t since_ckpt;
+    char *output;                // held until the reducer exits cleanly
+    size_t output_len, output_cap;
+    int input_closed;
+    int attempts;
+    int exited, status;
+    int finished;
+};
+
+struct MapperState mappers[MAX_MAPPERS];
+struct ReducerState reducers[MAX_REDUCERS];
+volatile sig_atomic_t child_exited = 0;
+
+void on_sigchld(int sig) {
+    (void)sig;
+    child_exited = 1;
+}
+
+void append(char **buf, size_t *len, size_t *cap, const char *data, size_t n) {
+    if (*len + n > *cap) {
+        size_t new_cap = *cap ? *cap : BUFFER_SIZE;
+        while (new_cap < *len + n) new_cap *= 2;
+        *buf = realloc(*buf, new_cap);
+        if (!*buf) error_exit("realloc");
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+}
+
+// Collect exit statuses so crashes are noticed even without pending I/O
+void reap_children() {
+    int status;
+    pid_t pid;
+    child_exited = 0;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < num_mappers; i++) {
+            if (mapper_pids[i] == pid) {
+                mappers[i].exited = 1;
+                mappers[i].status = status;
             }
-            for (int j = 0; j < NUM_REDUCERS; j++) {
-                if (j != i) {
-                    close(reducer_stdin[j][0]);
-                    close(reducer_stdin[j][1]);
-                    close(reducer_stdout[j][0]);
-                    close(reducer_stdout[j][1]);
-                }
+        }
+        for (int i = 0; i < num_reducers; i++) {
+            if (reducer_pids[i] == pid) {
+                reducers[i].exited = 1;
+                reducers[i].status = status;
             }
-            
-            // Redirect stdin/stdout
-            if (dup2(reducer_stdin[i][0], STDIN_FILENO) < 0) error_exit("dup2 stdin");
-            if (dup2(reducer_stdout[i][1], STDOUT_FILENO) < 0) error_exit("dup2 stdout");
-            
-            // Close original pipe ends
-            close(reducer_stdin[i][0]);
-            close(reducer_stdout[i][1]);
-            
-            execlp("./reducer", "./reducer", NULL);
-            error_exit("exec reducer");
         }
-        
-        reducer_pids[i] = pid;
     }
+}
+
+int exited_cleanly(int status) {
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void report_failure(const char *kind, int i, int status) {
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "%s %d was killed by signal %d\n", kind, i, WTERMSIG(status));
+    } else {
+        fprintf(stderr, "%s %d exited with status %d\n", kind, i, WEXITSTATUS(status));
+    }
+}
+
+// Read whole lines until the chunk is full
+struct Chunk *read_chunk(FILE *in, int seq) {
+    static char *line = NULL;
+    static size_t line_cap = 0;
+    const size_t header = 24;
 
-    // Close unused pipe ends in parent
-    for (int i = 0; i < NUM_MAPPERS; i++) {
-        close(mapper_stdin[i][0]);
-        close(mapper_stdout[i][1]);
+    struct Chunk *c = calloc(1, sizeof(struct Chunk));
+    size_t len = header, cap = header + CHUNK_SIZE + MAX_LINE;
+    if (!c || !(c->buf = malloc(cap))) error_exit("malloc chunk");
+
+    ssize_t n;
+    while (len - header < CHUNK_SIZE && (n = getline(&line, &line_cap, in)) > 0) {
+        append(&c->buf, &len, &cap, line, n);
     }
-    for (int i = 0; i < NUM_REDUCERS; i++) {
-        close(reducer_stdin[i][0]);
-        close(reducer_stdout[i][1]);
+    if (len == header) {
+        free(c->buf);
+        free(c);
+        return NULL;
     }
 
-    // Distribute input to mappers
-    fprintf(stderr, "Distributing input to mappers\n");
-    char line[MAX_LINE];
-    int current = 0;
-    while (fgets(line, sizeof(line), stdin)) {
-        fprintf(stderr, "Sending line to mapper %d: %s", current, line);
-        write_all(mapper_stdin[current][1], line, strlen(line));
-        current = (current + 1) % NUM_MAPPERS;
+    // Write the length header right in front of the payload
+    char hdr[32];
+    int hlen = snprintf(hdr, sizeof(hdr), "%zu\n", len - header);
+    c->frame = c->buf + header - hlen;
+    memcpy(c->frame, hdr, hlen);
+    c->len = len - header + hlen;
+    c->seq = seq;
+    return c;
+}
+
+int read_ckpt_epoch(int i) {
+    char path[PATH_MAX];
+    int epoch = 0;
+    ckpt_path(i, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "epoch %d", &epoch) != 1) epoch = 0;
+        fclose(f);
+    }
+    return epoch;
+}
+
+struct LogSegment *new_segment(int epoch) {
+    struct LogSegment *seg = calloc(1, sizeof(struct LogSegment));
+    if (!seg) error_exit("calloc segment");
+    seg->epoch = epoch;
+    return seg;
+}
+
+void restart_reducer(int i);
+
+// Write to a reducer, restarting it (and replaying its log) if it is gone
+void reducer_write(int i, const char *buf, size_t len) {
+    if (write_all(reducer_in[i], buf, len) < (ssize_t)len) {
+        restart_reducer(i);
+    }
+}
+
+// Ask a reducer to snapshot its table, and drop the log it no longer needs
+void request_checkpoint(int i) {
+    struct ReducerState *r = &reducers[i];
+    char msg[32];
+    int len = snprintf(msg, sizeof(msg), "!%d\n", ++r->epoch);
+    reducer_write(i, msg, len);
+
+    r->log_tail->next = new_segment(r->epoch);
+    r->log_tail = r->log_tail->next;
+    r->since_ckpt = 0;
+
+    int durable = read_ckpt_epoch(i);
+    while (r->log_head->epoch < durable) {
+        struct LogSegment *old = r->log_head;
+        r->log_head = old->next;
+        free(old->data);
+        free(old);
+    }
+}
+
+void restart_reducer(int i) {
+    struct ReducerState *r = &reducers[i];
+    if (++r->attempts > MAX_ATTEMPTS) {
+        fprintf(stderr, "Reducer %d failed too many times\n", i);
+        exit(1);
+    }
+
+    fprintf(stderr, "Reducer %d failed, restarting from checkpoint\n", i);
+    if (!r->exited && reducer_pids[i] > 0) {
+        kill(reducer_pids[i], SIGKILL);
+        waitpid(reducer_pids[i], NULL, 0);
+    }
+    close(reducer_in[i]);
+    close(reducer_out[i]);
+    r->exited = 0;
+    r->output_len = 0;
+    start_reducer(i);
+
+    // The new reducer loads the last durable checkpoint itself; replay
+    // everything it was sent after that
+    int durable = read_ckpt_epoch(i);
+    for (struct LogSegment *seg = r->log_head; seg; seg = seg->next) {
+        if (seg->epoch >= durable) {
+            reducer_write(i, seg->data, seg->len);
+        }
+    }
+    if (r->input_closed) {
+        close_input(reducer_in[i]);
+    }
+}
+
+// Without -f, records for each reducer are batched and written BATCH_SIZE
+// at a time rather than with one write per record
+#define BATCH_SIZE (64 * 1024)
+
+struct Batch {
+    char data[BATCH_SIZE];
+    size_t len;
+} batches[MAX_REDUCERS];
+
+void flush_reducer(int rid) {
+    write_all(reducer_in[rid], batches[rid].data, batches[rid].len);
+    batches[rid].len = 0;
+}
+
+void send_to_reducer(int rid, const char *buf, size_t len) {
+    if (!ft_mode) {
+        struct Batch *b = &batches[rid];
+        if (b->len + len > BATCH_SIZE) flush_reducer(rid);
+        memcpy(b->data + b->len, buf, len);
+        b->len += len;
+        return;
+    }
+
+    struct ReducerState *r = &reducers[rid];
+    struct LogSegment *seg = r->log_tail;
+    append(&seg->data, &seg->len, &seg->cap, buf, len);
+    reducer_write(rid, buf, len);
+
+    r->since_ckpt += len;
+    if (r->since_ckpt >= CKPT_BYTES) {
+        request_checkpoint(rid);
+    }
+}
+
+// The mapper acknowledged its oldest frame: release its output to the shuffle
+void commit_chunk(int i) {
+    struct MapperState *m = &mappers[i];
+    char *start = m->staged;
+    char *end = m->staged + m->staged_len;
+    char *newline;
+    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+        *newline = '\0';
+        relay_record(i, start);
+        start = newline + 1;
+    }
+    m->staged_len = 0;
+
+    struct Chunk *c = m->head;
+    if (!c) return;
+    fprintf(stderr, "Mapper %d finished chunk %d\n", i, c->seq);
+    m->head = c->next;
+    if (!m->head) m->tail = NULL;
+    m->inflight--;
+    free(c->buf);
+    free(c);
+}
+
+void restart_mapper(int i) {
+    struct MapperState *m = &mappers[i];
+    if (++m->attempts > MAX_ATTEMPTS) {
+        fprintf(stderr, "Mapper %d failed too many times\n", i);
+        exit(1);
+    }
+
+    fprintf(stderr, "Mapper %d failed, re-running %d chunk(s)\n", i, m->inflight);
+    if (!m->exited && mapper_pids[i] > 0) {
+        kill(mapper_pids[i], SIGKILL);
+        waitpid(mapper_pids[i], NULL, 0);
+    }
+    if (mapper_in[i] != -1) close(mapper_in[i]);
+    if (mapper_out[i] != -1) close(mapper_out[i]);
+
+    // Output of unacknowledged frames is discarded; they are sent again
+    m->exited = 0;
+    m->staged_len = 0;
+    m->pending_len = 0;
+    m->sending = m->head;
+    m->send_off = 0;
+
+    // The new process numbers its words from scratch
+    free(mapper_routes[i].routes);
+    mapper_routes[i].routes = NULL;
+    mapper_routes[i].cap = 0;
+
+    start_mapper(i);
+    fcntl(mapper_in[i], F_SETFL, fcntl(mapper_in[i], F_GETFL) | O_NONBLOCK);
+}
+
+// Mapper output ended (eof) or broke: either it is done or it died
+void mapper_eof(int i, int input_eof, int eof) {
+    struct MapperState *m = &mappers[i];
+    if (!m->exited) {
+        m->status = wait_task(mapper_pids[i], eof);
+        m->exited = 1;
     }
 
-    // Close mapper input pipes
-    for (int i = 0; i < NUM_MAPPERS; i++) {
-        close(mapper_stdin[i][1]);
+    if (exited_cleanly(m->status) && m->inflight == 0 && input_eof && mapper_in[i] == -1) {
+        close(mapper_out[i]);
+        mapper_out[i] = -1;
+        m->finished = 1;
+        return;
     }
+    restart_mapper(i);
+}
+
+void mapper_output(int i) {
+    struct MapperState *m = &mappers[i];
+    char *start = m->pending;
+    char *end = m->pending + m->pending_len;
+    char *newline;
+    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+        if (newline - start == 1 && start[0] == '.') {
+            commit_chunk(i);
+        } else {
+            append(&m->staged, &m->staged_len, &m->staged_cap, start, newline - start + 1);
+        }
+        start = newline + 1;
+    }
+    m->pending_len = end - start;
+    if (m->pending_len == sizeof(m->pending)) {
+        m->pending_len = 0;
+    } else if (m->pending_len > 0) {
+        memmove(m->pending, start, m->pending_len);
+    }
+}
+
+void run_fault_tolerant() {
+    snprintf(ckpt_dir, sizeof(ckpt_dir), "/tmp/mapreduce-XXXXXX");
+    if (!mkdtemp(ckpt_dir)) error_exit("mkdtemp");
 
-    // Process mapper output and send to reducers
-    fprintf(stderr, "Processing mapper output\n");
-    fd_set read_fds;
-    int max_fd = -1;
-    int active_mappers = NUM_MAPPERS;
-    char buffer[BUFFER_SIZE];
-    char word[256];
-    int count;
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigchld;
+    // A task dying while we block on stdin must not end the input early;
+    // select still returns EINTR and the loop reaps it there
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    fprintf(stderr, "Starting mapper processes\n");
+    for (int i = 0; i < num_mappers; i++) {
+        start_mapper(i);
+        fcntl(mapper_in[i], F_SETFL, fcntl(mapper_in[i], F_GETFL) | O_NONBLOCK);
+    }
+    fprintf(stderr, "Starting reducer processes\n");
+    for (int i = 0; i < num_reducers; i++) {
+        start_reducer(i);
+        reducers[i].log_head = reducers[i].log_tail = new_segment(0);
+    }
+    if (previous_path) load_previous(previous_path);
+
+    fprintf(stderr, "Distributing input to mappers\n");
+    int input_eof = 0;
+    int next_seq = 0;
+    int active_mappers = num_mappers;
+    fd_set read_fds, write_fds;
 
     while (active_mappers > 0) {
+        // Keep every mapper fed with up to MAX_INFLIGHT frames
+        for (int i = 0; i < num_mappers && !input_eof; i++) {
+            struct MapperState *m = &mappers[i];
+            while (!m->finished && m->inflight < MAX_INFLIGHT) {
+                struct Chunk *c = read_chunk(stdin, next_seq);
+                if (!c) {
+                    if (ferror(stdin)) error_exit("read input");
+                    input_eof = 1;
+                    break;
+                }
+                next_seq++;
+                if (m->tail) m->tail->next = c;
+                else m->head = c;
+                m->tail = c;
+                if (!m->sending) m->sending = c;
+                m->inflight++;
+            }
+        }
+        if (input_eof) {
+            for (int i = 0; i < num_mappers; i++) {
+                if (mapper_in[i] != -1 && !mappers[i].sending) {
+                    close_input(mapper_in[i]);
+                    mapper_in[i] = -1;
+                }
+            }
+        }
+
+        if (child_exited) reap_children();
+        for (int i = 0; i < num_reducers; i++) {
+            if (reducers[i].exited) restart_reducer(i);
+        }
+
         FD_ZERO(&read_fds);
-        max_fd = -1;
-        
-        // Add active mapper output pipes to fd_set
-        for (int i = 0; i < NUM_MAPPERS; i++) {
-            if (mapper_stdout[i][0] != -1) {
-                FD_SET(mapper_stdout[i][0], &read_fds);
-                if (mapper_stdout[i][0] > max_fd) {
-                    max_fd = mapper_stdout[i][0];
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        for (int i = 0; i < num_mappers; i++) {
+            if (mappers[i].finished) continue;
+            FD_SET(mapper_out[i], &read_fds);
+            if (mapper_out[i] > max_fd) max_fd = mapper_out[i];
+            if (mapper_in[i] != -1 && mappers[i].sending) {
+                FD_SET(mapper_in[i], &write_fds);
+                if (mapper_in[i] > max_fd) max_fd = mapper_in[i];
+            }
+        }
+
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
+            error_exit("select");
+        }
+
+        for (int i = 0; i < num_mappers; i++) {
+            struct MapperState *m = &mappers[i];
+            if (m->finished) continue;
+
+            if (mapper_in[i] != -1 && FD_ISSET(mapper_in[i], &write_fds)) {
+                struct Chunk *c = m->sending;
+                ssize_t n = write(mapper_in[i], c->frame + m->send_off, c->len - m->send_off);
+                if (n > 0) {
+                    m->send_off += n;
+                    if (m->send_off == c->len) {
+                        fprintf(stderr, "Sent chunk %d to mapper %d\n", c->seq, i);
+                        m->sending = c->next;
+                        m->send_off = 0;
+                    }
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    // The mapper is gone; its EOF below triggers the restart
+                    close(mapper_in[i]);
+                    mapper_in[i] = -1;
+                }
+            }
+
+            if (FD_ISSET(mapper_out[i], &read_fds)) {
+                ssize_t n = read(mapper_out[i], m->pending + m->pending_len,
+                                 sizeof(m->pending) - m->pending_len);
+                if (n > 0) {
+                    m->pending_len += n;
+                    mapper_output(i);
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    mapper_eof(i, input_eof, n == 0);
+                    if (m->finished) active_mappers--;
                 }
             }
         }
+    }
+
+    // Close reducer input pipes and collect results
+    fprintf(stderr, "Processing reducer output\n");
+    for (int i = 0; i < num_reducers; i++) {
+        reducers[i].input_closed = 1;
+        close_input(reducer_in[i]);
+    }
+
+    int active_reducers = num_reducers;
+    while (active_reducers > 0) {
+        FD_ZERO(&read_fds);
+        int max_fd = -1;
+        for (int i = 0; i < num_reducers; i++) {
+            if (reducers[i].finished) continue;
+            FD_SET(reducer_out[i], &read_fds);
+            if (reducer_out[i] > max_fd) max_fd = reducer_out[i];
+        }
 
         if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
             if (errno == EINTR) continue;
             error_exit("select");
         }
 
-        for (int i = 0; i < NUM_MAPPERS; i++) {
-            if (mapper_stdout[i][0] != -1 && FD_ISSET(mapper_stdout[i][0], &read_fds)) {
-                ssize_t n = read(mapper_stdout[i][0], buffer, sizeof(buffer) - 1);
+        for (int i = 0; i < num_reducers; i++) {
+            struct ReducerState *r = &reducers[i];
+            if (r->finished || !FD_ISSET(reducer_out[i], &read_fds)) continue;
+
+            char buffer[BUFFER_SIZE];
+            ssize_t n = read(reducer_out[i], buffer, sizeof(buffer));
+            if (n > 0) {
+                append(&r->output, &r->output_len, &r->output_cap, buffer, n);
+            } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                if (!r->exited) {
+                    r->status = wait_task(reducer_pids[i], n == 0);
+                    r->exited = 1;
+                }
+                if (exited_cleanly(r->status)) {
+                    close(reducer_out[i]);
+                    r->finished = 1;
+                    active_reducers--;
+                } else {
+                    restart_reducer(i);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < num_reducers; i++) {
+        write_all(STDOUT_FILENO, reducers[i].output, reducers[i].output_len);
+
+        char path[PATH_MAX];
+        ckpt_path(i, path, sizeof(path));
+        unlink(path);
+    }
+    rmdir(ckpt_dir);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Daemon mode                                                             */
+/* ---------------------------------------------------------------------- */
+
+// The daemon keeps one set of mappers and reducers for its lifetime and
+// runs client jobs through them one at a time. Mappers take framed chunks
+// as in fault-tolerant mode, so "every frame acknowledged" marks the end
+// of a job's map phase. A "." line then makes each reducer print its
+// results followed by ".", and clear its counts but keep its table, key
+// arena and dictionary warm for the next job.
+
+volatile sig_atomic_t daemon_stop = 0;
+
+void on_sigterm(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+// Run one job: input lines from in, results to out_fd. Returns -1, sending
+// no results, if reading the input failed part way.
+int run_job(FILE *in, int out_fd) {
+    int input_eof = 0;
+    int failed = 0;
+    int next_seq = 0;
+    fd_set read_fds, write_fds;
+
+    for (;;) {
+        int busy = 0;
+        for (int i = 0; i < num_mappers; i++) {
+            struct MapperState *m = &mappers[i];
+            while (!input_eof && m->inflight < MAX_INFLIGHT) {
+                struct Chunk *c = read_chunk(in, next_seq);
+                if (!c) {
+                    // The mapped part still runs through, which resets the
+                    // reducers for the next job
+                    if (ferror(in)) failed = 1;
+                    input_eof = 1;
+                    break;
+                }
+                next_seq++;
+                if (m->tail) m->tail->next = c;
+                else m->head = c;
+                m->tail = c;
+                if (!m->sending) m->sending = c;
+                m->inflight++;
+            }
+            if (m->inflight) busy = 1;
+        }
+        if (input_eof && !busy) break;
+
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        for (int i = 0; i < num_mappers; i++) {
+            FD_SET(mapper_out[i], &read_fds);
+            if (mapper_out[i] > max_fd) max_fd = mapper_out[i];
+            if (mappers[i].sending) {
+                FD_SET(mapper_in[i], &write_fds);
+                if (mapper_in[i] > max_fd) max_fd = mapper_in[i];
+            }
+        }
+
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
+            error_exit("select");
+        }
+
+        for (int i = 0; i < num_mappers; i++) {
+            struct MapperState *m = &mappers[i];
+            if (FD_ISSET(mapper_in[i], &write_fds)) {
+                struct Chunk *c = m->sending;
+                ssize_t n = write(mapper_in[i], c->frame + m->send_off, c->len - m->send_off);
                 if (n > 0) {
-                    buffer[n] = '\0';
-                    char *saveptr;
-                    char *line = strtok_r(buffer, "\n", &saveptr);
-                    
-                    while (line != NULL) {
-                        if (sscanf(line, "%255s %d", word, &count) == 2) {
-                            fprintf(stderr, "Mapper %d output: %s %d\n", i, word, count);
-                            int rid = hash_word(word, NUM_REDUCERS);
-                            char outbuf[512];
-                            int len = snprintf(outbuf, sizeof(outbuf), "%s %d\n", word, count);
-                            write_all(reducer_stdin[rid][1], outbuf, len);
-                        }
-                        line = strtok_r(NULL, "\n", &saveptr);
+                    m->send_off += n;
+                    if (m->send_off == c->len) {
+                        m->sending = c->next;
+                        m->send_off = 0;
                     }
-                } else if (n == 0) {
-                    close(mapper_stdout[i][0]);
-                    mapper_stdout[i][0] = -1;
-                    active_mappers--;
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    error_exit("mapper write");
+                }
+            }
+
+            if (FD_ISSET(mapper_out[i], &read_fds)) {
+                ssize_t n = read(mapper_out[i], m->pending + m->pending_len,
+                                 sizeof(m->pending) - m->pending_len);
+                if (n > 0) {
+                    m->pending_len += n;
+                    mapper_output(i);
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    fprintf(stderr, "Mapper %d exited\n", i);
+                    exit(1);
                 }
             }
         }
     }
 
-    // Close reducer input pipes
-    for (int i = 0; i < NUM_REDUCERS; i++) {
-        close(reducer_stdin[i][1]);
+    // Every record has reached the reducers: collect their results
+    for (int i = 0; i < num_reducers; i++) {
+        send_to_reducer(i, ".\n", 2);
+        flush_reducer(i);
     }
+    for (int i = 0; i < num_reducers; i++) {
+        struct ReducerState *r = &reducers[i];
+        r->output_len = 0;
+        for (;;) {
+            char buffer[BUFFER_SIZE];
+            ssize_t n = read(reducer_out[i], buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "Reducer %d exited\n", i);
+                exit(1);
+            }
+            append(&r->output, &r->output_len, &r->output_cap, buffer, n);
+            if (r->output_len >= 2 && memcmp(r->output + r->output_len - 2, ".\n", 2) == 0 &&
+                (r->output_len == 2 || r->output[r->output_len - 3] == '\n')) {
+                break;
+            }
+        }
+        if (!failed) write_all(out_fd, r->output, r->output_len - 2);
+    }
+    return failed ? -1 : 0;
+}
 
-    // Process reducer output
-    fprintf(stderr, "Processing reducer output\n");
-    int active_reducers = NUM_REDUCERS;
-    max_fd = -1;
+void run_daemon() {
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigterm;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
 
-    while (active_reducers > 0) {
-        FD_ZERO(&read_fds);
-        max_fd = -1;
-        
-        // Add active reducer output pipes to fd_set
-        for (int i = 0; i < NUM_REDUCERS; i++) {
-            if (reducer_stdout[i][0] != -1) {
-                FD_SET(reducer_stdout[i][0], &read_fds);
-                if (reducer_stdout[i][0] > max_fd) {
-                    max_fd = reducer_stdout[i][0];
+    fprintf(stderr, "Starting mapper processes\n");
+    for (int i = 0; i < num_mappers; i++) {
+        start_mapper(i);
+        fcntl(mapper_in[i], F_SETFL, fcntl(mapper_in[i], F_GETFL) | O_NONBLOCK);
+    }
+    fprintf(stderr, "Starting reducer processes\n");
+    for (int i = 0; i < num_reducers; i++) {
+        start_reducer(i);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(daemon_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", daemon_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, daemon_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) error_exit("socket");
+    unlink(daemon_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) error_exit(daemon_path);
+    if (listen(listen_fd, 64) < 0) error_exit("listen");
+    fprintf(stderr, "Daemon listening on %s\n", daemon_path);
+
+    // A stop request is only let through while waiting for the next job,
+    // so it never cuts a running job's input short. The tasks are already
+    // started and don't inherit the blocked mask.
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &stop_signals, &wait_mask);
+
+    int jobs = 0;
+    while (!daemon_stop) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(listen_fd, &fds);
+        if (pselect(listen_fd + 1, &fds, NULL, NULL, NULL, &wait_mask) < 0) continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        FILE *in = fdopen(fcntl(fd, F_DUPFD_CLOEXEC, 0), "r");
+        if (!in) error_exit("fdopen");
+        if (run_job(in, fd) < 0) {
+            fprintf(stderr, "Job %d failed reading its input; no result sent\n", ++jobs);
+        } else {
+            fprintf(stderr, "Finished job %d\n", ++jobs);
+        }
+        fclose(in);
+        close(fd);
+    }
+
+    fprintf(stderr, "Daemon stopping\n");
+    close(listen_fd);
+    unlink(daemon_path);
+    for (int i = 0; i < num_mappers; i++) {
+        close_input(mapper_in[i]);
+    }
+    for (int i = 0; i < num_reducers; i++) {
+        close_input(reducer_in[i]);
+    }
+    for (int i = 0; i < num_mappers; i++) {
+        waitpid(mapper_pids[i], NULL, 0);
+    }
+    for (int i = 0; i < num_reducers; i++) {
+        waitpid(reducer_pids[i], NULL, 0);
+    }
+}
+
+// Client side: send stdin as one job to the daemon at path, print results
+void run_client(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) error_exit("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) error_exit(path);
+
+    // The daemon reads the whole job before answering, so no deadlock here
+    char buffer[CHUNK_SIZE];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+        if (write_all(fd, buffer, n) < n) error_exit("send job");
+    }
+    shutdown(fd, SHUT_WR);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        write_all(STDOUT_FILENO, buffer, n);
+    }
+    close(fd);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Pipelined mode (default)                                                */
+/* ---------------------------------------------------------------------- */
+
+// Input queued for one mapper: whole lines, written as the pipe drains
+struct Feed {
+    char *buf;
+    size_t len, cap, off;
+};
+
+// Refill a drained feed with up to CHUNK_SIZE of whole lines; 0 at EOF
+int fill_feed(struct Feed *f) {
+    static char *line = NULL;
+    static size_t line_cap = 0;
+    ssize_t n;
+    f->len = f->off = 0;
+    while (f->len < CHUNK_SIZE && (n = getline(&line, &line_cap, stdin)) > 0) {
+        append(&f->buf, &f->len, &f->cap, line, n);
+    }
+    return f->len > 0;
+}
+
+// Read input, map, shuffle and reduce at the same time: one select loop
+// feeds mappers as their pipes drain, relays their records to the reducers
+// as they arrive, and forwards reducer output once the reducers finish.
+// Reducers aggregate while input is still being read, and since no stage
+// waits for the previous one to finish, full pipes can't deadlock.
+void run_pipelined() {
+    // A dead task shows up as EOF on its output instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Starting mapper processes\n");
+    for (int i = 0; i < num_mappers; i++) {
+        start_mapper(i);
+        fcntl(mapper_in[i], F_SETFL, fcntl(mapper_in[i], F_GETFL) | O_NONBLOCK);
+    }
+    fprintf(stderr, "Starting reducer processes\n");
+    for (int i = 0; i < num_reducers; i++) {
+        start_reducer(i);
+    }
+    if (previous_path) load_previous(previous_path);
+
+    static struct Feed feeds[MAX_MAPPERS];
+    // Whether each task's output ended cleanly, which is all a remote
+    // task's exit status is made of
+    int mapper_eof[MAX_MAPPERS] = {0}, reducer_eof[MAX_REDUCERS] = {0};
+    int input_eof = 0;
+    int active_mappers = num_mappers;
+    int active_reducers = num_reducers;
+    int reducers_closed = 0;
+
+    // Records can straddle read() boundaries, so keep each mapper's
+    // unfinished trailing line until the rest of it arrives
+    static char pending[MAX_MAPPERS][BUFFER_SIZE];
+    size_t pending_len[MAX_MAPPERS] = {0};
+
+    // Reducers finish at different times, so only forward whole lines;
+    // otherwise two reducers' output can interleave mid-line
+    static char out_pending[MAX_REDUCERS][BUFFER_SIZE];
+    size_t out_len[MAX_REDUCERS] = {0};
+
+    fd_set read_fds, write_fds;
+
+    while (active_mappers > 0 || active_reducers > 0) {
+        // Hand input to every mapper whose previous chunk has been written
+        for (int i = 0; i < num_mappers && !input_eof; i++) {
+            struct Feed *f = &feeds[i];
+            if (mapper_in[i] != -1 && f->off == f->len && !fill_feed(f)) {
+                input_eof = 1;
+            }
+        }
+        if (input_eof) {
+            for (int i = 0; i < num_mappers; i++) {
+                if (mapper_in[i] != -1 && feeds[i].off == feeds[i].len) {
+                    close_input(mapper_in[i]);
+                    mapper_in[i] = -1;
                 }
             }
         }
+        if (active_mappers == 0 && !reducers_closed) {
+            for (int i = 0; i < num_reducers; i++) {
+                flush_reducer(i);
+                close_input(reducer_in[i]);
+            }
+            reducers_closed = 1;
+        }
 
-        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        for (int i = 0; i < num_mappers; i++) {
+            if (mapper_in[i] != -1 && feeds[i].off < feeds[i].len) {
+                FD_SET(mapper_in[i], &write_fds);
+                if (mapper_in[i] > max_fd) max_fd = mapper_in[i];
+            }
+            if (mapper_out[i] != -1) {
+                FD_SET(mapper_out[i], &read_fds);
+                if (mapper_out[i] > max_fd) max_fd = mapper_out[i];
+            }
+        }
+        for (int i = 0; i < num_reducers; i++) {
+            if (reducer_out[i] != -1) {
+                FD_SET(reducer_out[i], &read_fds);
+                if (reducer_out[i] > max_fd) max_fd = reducer_out[i];
+            }
+        }
+
+        if (select(max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
             if (errno == EINTR) continue;
             error_exit("select");
         }
 
-        for (int i = 0; i < NUM_REDUCERS; i++) {
-            if (reducer_stdout[i][0] != -1 && FD_ISSET(reducer_stdout[i][0], &read_fds)) {
-                ssize_t n = read(reducer_stdout[i][0], buffer, sizeof(buffer));
+        for (int i = 0; i < num_mappers; i++) {
+            struct Feed *f = &feeds[i];
+            if (mapper_in[i] != -1 && FD_ISSET(mapper_in[i], &write_fds)) {
+                ssize_t n = write(mapper_in[i], f->buf + f->off, f->len - f->off);
+                if (n > 0) {
+                    f->off += n;
+                    if (f->off == f->len) {
+                        fprintf(stderr, "Sent %zu bytes to mapper %d\n", f->len, i);
+                    }
+                } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    // The mapper is gone; drop what it didn't take
+                    close(mapper_in[i]);
+                    mapper_in[i] = -1;
+                }
+            }
+
+            if (mapper_out[i] != -1 && FD_ISSET(mapper_out[i], &read_fds)) {
+                ssize_t n = read(mapper_out[i], pending[i] + pending_len[i],
+                                 BUFFER_SIZE - 1 - pending_len[i]);
+                if (n > 0) {
+                    char *start = pending[i];
+                    char *end = pending[i] + pending_len[i] + n;
+                    char *newline;
+                    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+                        *newline = '\0';
+                        relay_record(i, start);
+                        start = newline + 1;
+                    }
+                    pending_len[i] = end - start;
+                    if (pending_len[i] == BUFFER_SIZE - 1) {
+                        // No record is this long; drop it
+                        pending_len[i] = 0;
+                    } else if (pending_len[i] > 0) {
+                        memmove(pending[i], start, pending_len[i]);
+                    }
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    if (pending_len[i] > 0) {
+                        pending[i][pending_len[i]] = '\0';
+                        relay_record(i, pending[i]);
+                        pending_len[i] = 0;
+                    }
+                    mapper_eof[i] = n == 0;
+                    close(mapper_out[i]);
+                    mapper_out[i] = -1;
+                    active_mappers--;
+                }
+            }
+        }
+
+        for (int i = 0; i < num_reducers; i++) {
+            if (reducer_out[i] != -1 && FD_ISSET(reducer_out[i], &read_fds)) {
+                ssize_t n = read(reducer_out[i], out_pending[i] + out_len[i],
+                                 BUFFER_SIZE - out_len[i]);
                 if (n > 0) {
-                    write_all(STDOUT_FILENO, buffer, n);
-                } else if (n == 0) {
-                    close(reducer_stdout[i][0]);
-                    reducer_stdout[i][0] = -1;
+                    out_len[i] += n;
+                    char *last = memrchr(out_pending[i], '\n', out_len[i]);
+                    size_t complete = last ? (size_t)(last - out_pending[i]) + 1 : out_len[i];
+                    // A full buffer without a newline cannot be held back any longer
+                    if (last || out_len[i] == BUFFER_SIZE) {
+                        write_all(STDOUT_FILENO, out_pending[i], complete);
+                        out_len[i] -= complete;
+                        memmove(out_pending[i], out_pending[i] + complete, out_len[i]);
+                    }
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    write_all(STDOUT_FILENO, out_pending[i], out_len[i]);
+                    out_len[i] = 0;
+                    reducer_eof[i] = n == 0;
+                    close(reducer_out[i]);
+                    reducer_out[i] = -1;
                     active_reducers--;
                 }
             }
         }
     }
 
-    // Wait for all child processes
+    // A task that died took its records with it, and its pipe just looked
+    // like an early EOF, so only the exit statuses tell a complete result
     fprintf(stderr, "Waiting for child processes\n");
-    for (int i = 0; i < NUM_MAPPERS; i++) {
-        waitpid(mapper_pids[i], NULL, 0);
+    int failed = 0;
+    for (int i = 0; i < num_mappers; i++) {
+        int status = wait_task(mapper_pids[i], mapper_eof[i]);
+        if (!exited_cleanly(status)) {
+            report_failure("Mapper", i, status);
+            failed = 1;
+        }
     }
-    for (int i = 0; i < NUM_REDUCERS; i++) {
-        waitpid(reducer_pids[i], NULL, 0);
+    for (int i = 0; i < num_reducers; i++) {
+        int status = wait_task(reducer_pids[i], reducer_eof[i]);
+        if (!exited_cleanly(status)) {
+            report_failure("Reducer", i, status);
+            failed = 1;
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "Output is incomplete\n");
+        exit(1);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Shared-table mode (-M)                                                  */
+/* ---------------------------------------------------------------------- */
+
+// Table sizes like "1M"; 0 if s isn't one or is more than the table allows
+uint64_t parse_count(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s) return 0;
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; end++; break;
+    case 'm': case 'M': v *= 1024 * 1024; end++; break;
+    case 'g': case 'G': v *= 1024.0 * 1024 * 1024; end++; break;
+    }
+    if (*end != '\0' || !(v >= 1 && v <= TABLE_MAX_SLOTS)) return 0;
+    return (uint64_t)v;
+}
+
+// Keys in descending order, as each reducer outputs them
+int compare_entries(const void *a, const void *b) {
+    const struct table_entry *x = *(struct table_entry *const *)a;
+    const struct table_entry *y = *(struct table_entry *const *)b;
+    return strcmp(y->key, x->key);
+}
+
+// Print the table once every mapper has exited, formatted like reducer
+// output: "key value", or for a distinct job "key <distinct values>"
+void output_table() {
+    if (atomic_load(&table.header->full)) {
+        fprintf(stderr, "Shared table is full at %llu keys; raise -M\n",
+                (unsigned long long)atomic_load(&table.header->keys));
+        exit(1);
+    }
+
+    uint64_t keys = atomic_load(&table.header->keys);
+    struct table_entry **arr = malloc((keys ? keys : 1) * sizeof(*arr));
+    if (!arr) error_exit("malloc");
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < table.header->capacity && count < keys; i++) {
+        struct table_entry *e = table_entry(&table, i);
+        if (e) arr[count++] = e;
+    }
+    qsort(arr, count, sizeof(*arr), compare_entries);
+
+    long long min = min_count ? parse_option("-n", min_count, LLONG_MIN, LLONG_MAX) : LLONG_MIN;
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    char line[MAX_WORD_LEN + 32];
+    int len;
+    if (job->distinct) {
+        for (uint64_t i = 0; i < count; ) {
+            char key[MAX_WORD_LEN];
+            int prefix = strcspn(arr[i]->key, "\t");
+            uint64_t j = i + 1;
+            while (j < count && strncmp(arr[j]->key, arr[i]->key, prefix) == 0 &&
+                   arr[j]->key[prefix] == '\t') {
+                j++;
+            }
+            if ((long long)(j - i) >= min) {
+                memcpy(key, arr[i]->key, prefix);
+                key[prefix] = '\0';
+                len = job->codec->format(line, sizeof(line), key, j - i);
+                fwrite(line, 1, len, stdout);
+            }
+            i = j;
+        }
+    } else {
+        for (uint64_t i = 0; i < count; i++) {
+            long long value = atomic_load_explicit(&arr[i]->value, memory_order_relaxed);
+            if (value >= min) {
+                len = job->codec->format(line, sizeof(line), arr[i]->key, value);
+                fwrite(line, 1, len, stdout);
+            }
+        }
+    }
+    fflush(stdout);
+    free(arr);
+    fprintf(stderr, "Shared table: %llu keys\n", (unsigned long long)count);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "j:k:v:w:m:r:t:H:s:l:L:p:x:n:i:A:M:D:U:CSVdf")) != -1) {
+        switch (opt) {
+        case 'm':
+            num_mappers = atoi(optarg);
+            break;
+        case 'r':
+            num_reducers = atoi(optarg);
+            break;
+        case 't':
+            reducer_threads = optarg;
+            break;
+        case 'H':
+            for (char *addr = strtok(optarg, ","); addr; addr = strtok(NULL, ",")) {
+                if (num_workers == MAX_WORKERS) {
+                    fprintf(stderr, "At most %d workers\n", MAX_WORKERS);
+                    exit(1);
+                }
+                workers[num_workers++] = addr;
+            }
+            break;
+        case 'j':
+            job_name = optarg;
+            break;
+        case 'k':
+            key_field = optarg;
+            break;
+        case 'v':
+            value_field = optarg;
+            break;
+        case 'w':
+            bucket_width = optarg;
+            break;
+        case 'C':
+            combine_mode = 1;
+            break;
+        case 'S':
+            size_hints = 0;
+            break;
+        case 's':
+        case 'l':
+        case 'L':
+        case 'p':
+        case 'x':
+            for (int f = 0; f < NUM_FILTERS; f++) {
+                if (filters[f].flag[1] == opt) filters[f].value = optarg;
+            }
+            break;
+        case 'n':
+            min_count = optarg;
+            break;
+        case 'i':
+            previous_path = optarg;
+            break;
+        case 'A':
+            placement = optarg;
+            break;
+        case 'M':
+            shared_slots = parse_count(optarg);
+            if (!shared_slots) {
+                fprintf(stderr, "Bad table size: %s (1 to %llu slots, K/M/G suffixes)\n",
+                        optarg, (unsigned long long)TABLE_MAX_SLOTS);
+                exit(1);
+            }
+            break;
+        case 'D':
+            daemon_path = optarg;
+            break;
+        case 'U':
+            run_client(optarg);
+            return 0;
+        case 'V':
+            verbose = 1;
+            break;
+        case 'd':
+            dict_mode = 1;
+            break;
+        case 'f':
+            ft_mode = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j job] [-k field] [-v field] [-w width] [-m mappers] [-r reducers] [-t threads]\n"
+                    "          [-H host:port,...] [-s stopfile] [-l min] [-L max] [-p prefix,...]\n"
+                    "          [-x regex] [-n min] [-i previous] [-A numa|cpulist] [-M slots] [-D socket]\n"
+                    "          [-U socket] [-C] [-S] [-V] [-d] [-f]\n"
+                    "          < input > output\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (num_mappers < 1 || num_mappers > MAX_MAPPERS ||
+        num_reducers < 1 || num_reducers > MAX_REDUCERS) {
+        fprintf(stderr, "Need 1-%d mappers and 1-%d reducers\n", MAX_MAPPERS, MAX_REDUCERS);
+        exit(1);
+    }
+
+    job = find_job(job_name);
+    if (!job) {
+        fprintf(stderr, "Unknown job: %s\n", job_name);
+        list_jobs(stderr);
+        exit(1);
+    }
+    check_job_options();
+    check_filters();
+    // A distinct job's output holds counts, not the values behind them
+    if (previous_path && (job->distinct || daemon_path)) {
+        fprintf(stderr, "-i can't be used with distinct jobs or -D\n");
+        exit(1);
+    }
+
+    if (shared_slots) {
+        if (dict_mode || ft_mode || daemon_path || num_workers) {
+            fprintf(stderr, "-M can't be used with -d, -f, -D or -H\n");
+            exit(1);
+        }
+        int fd = table_create(shared_slots, &table);
+        if (fd < 0) error_exit("shared table");
+        snprintf(table_fd, sizeof(table_fd), "%d", fd);
+        // The table takes the reducers' place
+        num_reducers = 0;
+    }
+
+    if (placement) {
+        // Worker hosts schedule their own tasks
+        if (num_workers) {
+            fprintf(stderr, "-A places local tasks and can't be used with -H\n");
+            exit(1);
+        }
+        plan_placement(placement);
+    }
+
+    fprintf(stderr, "Starting main program\n");
+    init_sketches();
+
+    if (daemon_path) {
+        if (ft_mode || num_workers) {
+            fprintf(stderr, "-D runs local tasks without -f\n");
+            exit(1);
+        }
+        run_daemon();
+    } else if (ft_mode) {
+        run_fault_tolerant();
+    } else {
+        run_pipelined();
+        if (shared_slots) output_table();
     }
 
     fprintf(stderr, "Program completed\n");
     return 0;
 }
-
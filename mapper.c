@@ -1,4 +1,20 @@
-// Compile: gcc -O2 mapper.c -o mapper
+// Compile: gcc -O2 mapper.c job.c table.c -o mapper
+// Run: ./mapper [-j job] [-k field] [-v field] [-w width] [-s stopfile] [-l min]
+//                [-L max] [-p prefix,...] [-x regex] [-M fd] [-C] [-d] [-f]
+//   -j  job from job.c (default wordcount); -k/-v/-w pick the log fields
+//   -s/-l/-L/-p/-x  word filters: drop stop words (one per line in the file)
+//       and words shorter/longer than min/max characters; keep only words
+//       starting with one of the prefixes / matching the extended regex
+//   -C  combine values per key in the mapper before emitting them
+// Input is tokenized straight out of the read buffer. Buffers that are pure
+// ASCII take a table-driven byte loop; any other buffer is decoded as UTF-8,
+// with Unicode letters case-folded via unicode_tables.h.
+//   -d  dictionary encoding: "= <id> <word>" the first time a word is seen,
+//       then "<id> 1" for every occurrence
+//   -f  framed input: "<len>\n" followed by len bytes of lines; a "." line
+//       is written once all output for a frame has been written
+//   -M  fold records into the shared table (table.h) behind this inherited
+//       fd instead of writing them; exits 1 if the table fills up
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,9 +23,177 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <regex.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "unicode_tables.h"
+#include "job.h"
+#include "table.h"
 
 #define MAX_WORD_LEN 256
 #define BUFFER_SIZE 4096
+#define READ_SIZE (BUFFER_SIZE * 16)
+
+#define COMBINE_MAX (1 << 16)   // keys held by the combiner before a flush
+
+int dict_mode = 0;
+int frame_mode = 0;
+int combine_mode = 0;
+int table_mode = 0;
+struct table table;
+const struct job *job;
+struct job_options job_opts = {1, 2, 10};
+
+// word -> local id table for dictionary encoding
+struct DictSlot {
+    char *word;
+    int id;
+};
+
+struct DictSlot *dict_slots = NULL;
+int dict_cap = 0;
+int dict_size = 0;
+
+unsigned int dict_hash(const char *word) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; word[i]; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void dict_grow() {
+    int new_cap = dict_cap ? dict_cap * 2 : 1024;
+    struct DictSlot *slots = calloc(new_cap, sizeof(struct DictSlot));
+    if (!slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < dict_cap; i++) {
+        if (!dict_slots[i].word) continue;
+        unsigned int h = dict_hash(dict_slots[i].word) & (new_cap - 1);
+        while (slots[h].word) h = (h + 1) & (new_cap - 1);
+        slots[h] = dict_slots[i];
+    }
+    free(dict_slots);
+    dict_slots = slots;
+    dict_cap = new_cap;
+}
+
+// 输出一条记录：文本模式直接输出，字典模式输出编号
+void write_record(const char *key, int len, long long value) {
+    if (table_mode) {
+        // 共享表模式：直接在共享内存里合并，不经过 shuffle
+        if (!table_add(&table, key, len, value, job->fold)) {
+            fprintf(stderr, "Shared table is full; raise -M\n");
+            exit(1);
+        }
+        return;
+    }
+    if (!dict_mode) {
+        char buf[MAX_WORD_LEN + 32];
+        int n = job->codec->format(buf, sizeof(buf), key, value);
+        if (n > 0 && n < (int)sizeof(buf)) fwrite(buf, 1, n, stdout);
+        return;
+    }
+
+    if ((dict_size + 1) * 2 > dict_cap) dict_grow();
+
+    unsigned int h = dict_hash(key) & (dict_cap - 1);
+    while (dict_slots[h].word) {
+        if (strcmp(dict_slots[h].word, key) == 0) {
+            printf("%d %lld\n", dict_slots[h].id, value);
+            return;
+        }
+        h = (h + 1) & (dict_cap - 1);
+    }
+
+    // 新单词：先发送定义，之后只发送编号
+    dict_slots[h].word = strdup(key);
+    if (!dict_slots[h].word) {
+        perror("strdup");
+        exit(1);
+    }
+    dict_slots[h].id = dict_size++;
+    printf("= %d %s\n", dict_slots[h].id, key);
+    printf("%d %lld\n", dict_slots[h].id, value);
+}
+
+// 合并器：同一个键的值先在 mapper 里用 job->fold 合并
+struct CombineSlot {
+    char *key;
+    int len;
+    long long value;
+};
+
+struct CombineSlot *combine_slots = NULL;
+int combine_cap = 0;
+int combine_size = 0;
+
+void combine_flush() {
+    for (int i = 0; i < combine_cap; i++) {
+        if (!combine_slots[i].key) continue;
+        write_record(combine_slots[i].key, combine_slots[i].len, combine_slots[i].value);
+        free(combine_slots[i].key);
+        combine_slots[i].key = NULL;
+    }
+    combine_size = 0;
+}
+
+void combine_add(const char *key, int len, long long value) {
+    if (!combine_slots) {
+        combine_cap = COMBINE_MAX * 2;
+        combine_slots = calloc(combine_cap, sizeof(struct CombineSlot));
+        if (!combine_slots) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+
+    unsigned int h = dict_hash(key) & (combine_cap - 1);
+    while (combine_slots[h].key) {
+        if (combine_slots[h].len == len && memcmp(combine_slots[h].key, key, len) == 0) {
+            combine_slots[h].value = job->fold(combine_slots[h].value, value);
+            return;
+        }
+        h = (h + 1) & (combine_cap - 1);
+    }
+
+    if (combine_size == COMBINE_MAX) {
+        combine_flush();
+        combine_add(key, len, value);
+        return;
+    }
+    combine_slots[h].key = strndup(key, len);
+    if (!combine_slots[h].key) {
+        perror("strndup");
+        exit(1);
+    }
+    combine_slots[h].len = len;
+    combine_slots[h].value = value;
+    combine_size++;
+}
+
+// 输出 map 产生的一个 (键, 值)；键必须以 '\0' 结尾
+void emit_record(const char *key, int len, long long value) {
+    if (combine_mode) {
+        combine_add(key, len, value);
+    } else {
+        write_record(key, len, value);
+    }
+}
+
+// 帧模式：通知 main 当前帧的输出已经完整
+void emit_commit() {
+    if (combine_mode) combine_flush();
+    printf(".\n");
+    fflush(stdout);
+}
 
 // Helper function to check if a word ends with a pattern
 int ends_with(const char* word, const char* pattern) {
@@ -209,256 +393,631 @@ void preprocess_line(char *line) {
 }
 
 
-void clean_smart_quotes(char* str) {
-    int i = 0, j = 0;
-    while (str[i]) {
-        // Skip smart quotes
-        if ((unsigned char)str[i] == 0xE2 &&
-            (unsigned char)str[i + 1] == 0x80 &&
-            ((unsigned char)str[i + 2] == 0x98 ||  // ‘
-             (unsigned char)str[i + 2] == 0x99) ||
-             (unsigned char)str[i + 2] == 0x94)   // ’
-        {
-
-            i += 3;
-            continue;
+// 检查一段数据是否全是 ASCII；SSE2 每次检查 16 字节
+bool is_ascii(const char *s, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(v)) return false;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, sizeof(w));
+        if (w & 0x8080808080808080ULL) return false;
+    }
+    for (; i < n; i++) {
+        if ((unsigned char)s[i] & 0x80) return false;
+    }
+    return true;
+}
+
+// 非 ASCII 字符的类别（字母 / 其他单词字符 / 删除 / 分隔符）
+int uc_class(unsigned int cp) {
+    int lo = 0, hi = UC_CLASS_RANGES - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < uc_class_ranges[mid].start) {
+            hi = mid - 1;
+        } else if (cp > uc_class_ranges[mid].end) {
+            lo = mid + 1;
         } else {
-            str[j++] = str[i++];
+            return uc_class_ranges[mid].cls;
         }
     }
-    str[j] = '\0';
+    return UC_SEP;
 }
 
-// 修改字符串，处理缩写和连字符
-void normalize_string(char* str) {
-    clean_smart_quotes(str);
-    int len = strlen(str);
-    
-    // 转换为小写
-    for (int i = 0; i < len; i++) {
-        str[i] = tolower((unsigned char)str[i]);
-    }
-    // 替换 Unicode 引号为普通撇号
-for (int i = 0; str[i]; i++) {
-    if ((unsigned char)str[i] == 0xE2 && 
-        (unsigned char)str[i + 1] == 0x80 &&
-        ((unsigned char)str[i + 2] == 0x99 ||  // ’
-         (unsigned char)str[i + 2] == 0x9C ||  // “
-         (unsigned char)str[i + 2] == 0x9D))   // ”
-    {
-        str[i] = '\'';
-        memmove(&str[i + 1], &str[i + 3], strlen(&str[i + 3]) + 1);
-    }
-}
-
-    // 处理所有格（将"beauty's"变为"beautys"）
-    char *pos = strstr(str, "'s");
-    while (pos != NULL) {
-        // 替换's为s
-        *pos = 's';
-        // 删除后面的字符
-        memmove(pos + 1, pos + 2, strlen(pos + 2) + 1);
-        len--;
-        
-        // 查找下一个's
-        pos = strstr(str, "'s");
+// 简单大小写折叠（一对一映射）
+unsigned int uc_fold(unsigned int cp) {
+    int lo = 0, hi = UC_FOLD_RANGES - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const struct uc_fold_range *r = &uc_fold_ranges[mid];
+        if (cp < r->start) {
+            hi = mid - 1;
+        } else if (cp > r->end) {
+            lo = mid + 1;
+        } else {
+            return (cp - r->start) % r->stride == 0 ? cp + r->delta : cp;
+        }
     }
-    
-    // 处理缩写't（将"don't"、"Feed'st"变为"dont"、"feedst"）
-    pos = strstr(str, "'t");
-    while (pos != NULL) {
-        // 替换't为t
-        *pos = 't';
-        // 删除后面的字符
-        memmove(pos + 1, pos + 2, strlen(pos + 2) + 1);
-        len--;
-        
-        pos = strstr(str, "'t");
+    return cp;
+}
+
+// 解码一个 UTF-8 字符，返回字节数；非法序列返回 0
+int utf8_decode(const unsigned char *s, size_t n, unsigned int *cp) {
+    unsigned int c = s[0];
+    int len;
+    unsigned int min;
+    if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        c &= 0x07;
+        min = 0x10000;
+    } else if (c >= 0xE0) {
+        len = 3;
+        c &= 0x0F;
+        min = 0x800;
+    } else if (c >= 0xC2 && c < 0xE0) {
+        len = 2;
+        c &= 0x1F;
+        min = 0x80;
+    } else {
+        return 0;
     }
-    
-    // 处理连字符（将"self-substantial"变为"selfsubstantial"）
-    pos = strchr(str, '-');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '-');
+    if ((size_t)len > n) return 0;
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+        c = (c << 6) | (s[i] & 0x3F);
     }
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return 0;
+    *cp = c;
+    return len;
+}
 
-    pos = strchr(str, '<');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '<');
+int utf8_encode(unsigned int cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
     }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
 
-    pos = strchr(str, '>');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '>');
+/* ---------------------------------------------------------------------- */
+/* 单词过滤                                                                */
+/* ---------------------------------------------------------------------- */
+
+// 过滤条件在分词时执行：被过滤的单词不会输出，也就不进入 shuffle。
+// 停用词表是 CHD（compress, hash and displace）完美哈希：键先分到桶里，
+// 每个桶找一个位移 (d0, d1)，使桶内所有键落到 (f1 + d0 * f2 + d1) % m
+// 的空槽位。查询只需一次哈希、一次位移表读取和一次 strcmp。
+
+struct StopSet {
+    char **keys;        // 槽位 -> 停用词，空槽为 NULL
+    uint32_t *disp;     // 桶 -> 位移 d0 * m + d1
+    uint32_t m;         // 槽位数
+    uint32_t r;         // 桶数
+    uint64_t seed;
+};
+
+struct StopSet stop_set;
+bool filter_on = false;
+int min_len = 0;        // 以字符计，0 表示不限
+int max_len = 0;
+char *prefixes[64];
+int num_prefixes = 0;
+regex_t key_regex;
+bool regex_on = false;
+
+uint64_t stop_hash(const char *s, int len, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
     }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
 
-    pos = strchr(str, '.');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '.');
+// 一个哈希值拆成桶号和槽位公式里的 f1、f2
+void stop_parts(uint64_t h, uint32_t *b, uint32_t *f1, uint32_t *f2) {
+    *b = (uint32_t)h % stop_set.r;
+    *f1 = (uint32_t)(h >> 32) % stop_set.m;
+    *f2 = (uint32_t)((h >> 16) ^ (h >> 48)) % stop_set.m;
+}
+
+uint32_t stop_slot(uint32_t f1, uint32_t f2, uint32_t d) {
+    uint32_t m = stop_set.m;
+    return (uint32_t)((f1 + (uint64_t)(d / m) * f2 + d % m) % m);
+}
+
+bool is_stop_word(const char *w, int len) {
+    if (stop_set.m == 0) return false;
+    uint32_t b, f1, f2;
+    stop_parts(stop_hash(w, len, stop_set.seed), &b, &f1, &f2);
+    char *key = stop_set.keys[stop_slot(f1, f2, stop_set.disp[b])];
+    return key && strcmp(key, w) == 0;
+}
+
+int compare_str(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// 桶内键数多的先放
+uint32_t *bucket_size;
+int compare_bucket(const void *a, const void *b) {
+    return (int)bucket_size[*(const uint32_t *)b] - (int)bucket_size[*(const uint32_t *)a];
+}
+
+// 为 n 个（已去重的）键构造完美哈希；某个桶找不到位移时换种子重来
+void stop_build(char **words, int n) {
+    uint32_t m = n + n / 4 + 1;
+    uint32_t r = n / 4 + 1;
+    uint32_t *part_b = malloc(n * sizeof(uint32_t));
+    uint32_t *part_f1 = malloc(n * sizeof(uint32_t));
+    uint32_t *part_f2 = malloc(n * sizeof(uint32_t));
+    uint32_t *members = malloc(n * sizeof(uint32_t));    // 按桶排列的键下标
+    uint32_t *start = malloc((r + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc(r * sizeof(uint32_t));
+    uint32_t *placed = malloc(n * sizeof(uint32_t));
+    bucket_size = malloc(r * sizeof(uint32_t));
+    stop_set.keys = malloc(m * sizeof(char *));
+    stop_set.disp = malloc(r * sizeof(uint32_t));
+    if (!part_b || !part_f1 || !part_f2 || !members || !start || !order || !placed ||
+        !bucket_size || !stop_set.keys || !stop_set.disp) {
+        perror("malloc");
+        exit(1);
     }
+    stop_set.m = m;
+    stop_set.r = r;
 
-    pos = strchr(str, '*');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '*');
+    for (stop_set.seed = 0; ; stop_set.seed++) {
+        memset(bucket_size, 0, r * sizeof(uint32_t));
+        memset(stop_set.keys, 0, m * sizeof(char *));
+        for (int i = 0; i < n; i++) {
+            stop_parts(stop_hash(words[i], strlen(words[i]), stop_set.seed),
+                       &part_b[i], &part_f1[i], &part_f2[i]);
+            bucket_size[part_b[i]]++;
+        }
+        start[0] = 0;
+        for (uint32_t b = 0; b < r; b++) {
+            start[b + 1] = start[b] + bucket_size[b];
+            order[b] = b;
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            members[--start[part_b[i] + 1]] = i;
+        }
+        for (uint32_t b = 0; b < r; b++) start[b + 1] = start[b] + bucket_size[b];
+        qsort(order, r, sizeof(uint32_t), compare_bucket);
+
+        bool ok = true;
+        for (uint32_t k = 0; k < r && ok && bucket_size[order[k]] > 0; k++) {
+            uint32_t b = order[k];
+            ok = false;
+            for (uint64_t d = 0; d < (uint64_t)m * m && !ok; d++) {
+                uint32_t count = 0;
+                for (uint32_t j = start[b]; j < start[b + 1]; j++) {
+                    uint32_t i = members[j];
+                    uint32_t slot = stop_slot(part_f1[i], part_f2[i], d);
+                    // 同桶的两个键也不能落到同一槽位
+                    if (stop_set.keys[slot]) break;
+                    stop_set.keys[slot] = words[i];
+                    placed[count++] = slot;
+                }
+                if (count == bucket_size[b]) {
+                    stop_set.disp[b] = d;
+                    ok = true;
+                } else {
+                    while (count > 0) stop_set.keys[placed[--count]] = NULL;
+                }
+            }
+        }
+        if (ok) break;
     }
 
-    pos = strchr(str, '(');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '(');
+    free(part_b);
+    free(part_f1);
+    free(part_f2);
+    free(members);
+    free(start);
+    free(order);
+    free(placed);
+    free(bucket_size);
+}
+
+void tokenize(const char *data, size_t n);
+void tokenize_flush();
+
+// 读停用词时分词器把单词交给这里，而不是 emit_record
+bool loading_stop_words = false;
+char **stop_words = NULL;
+int stop_count = 0, stop_cap = 0;
+
+void add_stop_word(const char *w) {
+    if (stop_count == stop_cap) {
+        stop_cap = stop_cap ? stop_cap * 2 : 64;
+        stop_words = realloc(stop_words, stop_cap * sizeof(char *));
+        if (!stop_words) {
+            perror("realloc");
+            exit(1);
+        }
     }
+    stop_words[stop_count++] = strdup(w);
+}
 
-    pos = strchr(str, ')');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, ')');
+// 停用词文件每行一个词。每行都经过分词器，删除标点、大小写折叠等规则与
+// 输入完全相同，所以 "don't"、"dog-house"、"Über" 能匹配 "dont"、
+// "doghouse"、"über"
+void load_stop_words(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
     }
 
-    pos = strchr(str, '"');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '"');
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    loading_stop_words = true;
+    while ((len = getline(&line, &line_cap, f)) > 0) {
+        tokenize(line, len);
+        tokenize_flush();
     }
+    loading_stop_words = false;
+    free(line);
+    fclose(f);
 
-    pos = strchr(str, ':');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, ':');
+    char **words = stop_words;
+    int n = stop_count;
+    // 重复的词哈希完全相同，无法分开，先去重
+    qsort(words, n, sizeof(char *), compare_str);
+    int unique = 0;
+    for (int i = 0; i < n; i++) {
+        if (unique == 0 || strcmp(words[i], words[unique - 1]) != 0) {
+            words[unique++] = words[i];
+        }
     }
+    if (unique > 0) stop_build(words, unique);
+}
 
-    pos = strchr(str, '/');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '/');
+// 按长度、停用词、前缀白名单、正则的顺序检查，便宜的在前
+bool keep_word(const char *w, int len) {
+    if (min_len || max_len) {
+        int chars = 0;
+        for (int i = 0; i < len; i++) {
+            if (((unsigned char)w[i] & 0xC0) != 0x80) chars++;
+        }
+        if (chars < min_len || (max_len && chars > max_len)) return false;
     }
-    
-    pos = strchr(str, '{');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '{');
+    if (is_stop_word(w, len)) return false;
+    if (num_prefixes) {
+        int i = 0;
+        while (i < num_prefixes && strncmp(w, prefixes[i], strlen(prefixes[i])) != 0) i++;
+        if (i == num_prefixes) return false;
     }
+    if (regex_on && regexec(&key_regex, w, 0, NULL, 0) != 0) return false;
+    return true;
+}
 
-    pos = strchr(str, '}');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, '}');
+/* ---------------------------------------------------------------------- */
+/* 流式分词                                                                */
+/* ---------------------------------------------------------------------- */
+
+// 直接在 read() 缓冲区上分词，不再按行复制。规则与原来的
+// normalize_string + strtok 相同：删除 ' - < > . * ( ) " : / { } ,，
+// 按空白和 ; ! ? [ ] 分词，只输出含字母的单词。跨缓冲区边界时只保留
+// 半个单词和半个 UTF-8 字符，所以内存与行长无关。
+
+unsigned char ascii_class[128];
+char token[MAX_WORD_LEN];
+int token_len = 0;
+bool token_has_letter = false;
+bool token_too_long = false;
+unsigned char utf8_carry[4];
+int utf8_carry_len = 0;
+
+void init_ascii_class() {
+    for (int c = 0; c < 128; c++) {
+        if (c == 0 || strchr(" \t\n\r\f\v;!?[]", c)) {
+            ascii_class[c] = UC_SEP;
+        } else if (strchr("'-<>.*()\":/{},", c)) {
+            ascii_class[c] = UC_DELETE;
+        } else if (isalpha(c)) {
+            ascii_class[c] = UC_LETTER;
+        } else {
+            ascii_class[c] = UC_OTHER;
+        }
     }
+}
 
-    pos = strchr(str, ',');
-    while (pos != NULL) {
-        // 删除连字符
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        // 查找下一个连字符
-        pos = strchr(str, ',');
+// 单词结束：超过 MAX_WORD_LEN 的单词整个丢弃（main 和 reducer 也放不下）
+void token_end() {
+    if (token_len > 0 && token_has_letter && !token_too_long) {
+        token[token_len] = '\0';
+        if (loading_stop_words) {
+            add_stop_word(token);
+        } else if (!filter_on || keep_word(token, token_len)) {
+            emit_record(token, token_len, 1);
+        }
     }
-    
-    // 处理其他撇号（如果还有）
-    pos = strchr(str, '\'');
-    while (pos != NULL) {
-        // 删除撇号
-        memmove(pos, pos + 1, strlen(pos + 1) + 1);
-        len--;
-        
-        pos = strchr(str, '\'');
+    token_len = 0;
+    token_has_letter = false;
+    token_too_long = false;
+}
+
+void token_push(const char *s, int n, int cls) {
+    if (token_len + n >= MAX_WORD_LEN) {
+        token_too_long = true;
+        return;
     }
+    memcpy(token + token_len, s, n);
+    token_len += n;
+    if (cls == UC_LETTER) token_has_letter = true;
 }
 
+void ascii_char(unsigned char c) {
+    int cls = ascii_class[c];
+    if (cls == UC_SEP) {
+        token_end();
+    } else if (cls != UC_DELETE) {
+        char lower = tolower(c);
+        token_push(&lower, 1, cls);
+    }
+}
 
+void unicode_char(unsigned int cp) {
+    char enc[4];
+    int cls = uc_class(cp);
+    if (cls == UC_SEP) {
+        token_end();
+    } else if (cls != UC_DELETE) {
+        if (cls == UC_LETTER) cp = uc_fold(cp);
+        token_push(enc, utf8_encode(cp, enc), cls);
+    }
+}
 
-// 提取并处理单词
-void extract_words(char* line) {
-    // 创建一个副本来处理
-    char buffer[BUFFER_SIZE];
-    strncpy(buffer, line, BUFFER_SIZE - 1);
-    buffer[BUFFER_SIZE - 1] = '\0';
-    
-    // 标准化处理
-    normalize_string(buffer);
-    
-    char* word = strtok(buffer, " \t\n\r\f\v.,;:!?\"()[]{}");
-    
-    while (word != NULL) {
-        // 检查是否有字母字符
-        bool has_letter = false;
-        for (int i = 0; word[i]; i++) {
-            if (isalpha((unsigned char)word[i])) {
-                has_letter = true;
-                break;
+// 非法字节原样保留在单词里
+void raw_byte(unsigned char c) {
+    char b = c;
+    token_push(&b, 1, UC_OTHER);
+}
+
+// UTF-8 首字节对应的序列长度，非法首字节返回 1
+int utf8_length(unsigned char c) {
+    if (c >= 0xC2 && c <= 0xDF) return 2;
+    if (c >= 0xE0 && c <= 0xEF) return 3;
+    if (c >= 0xF0 && c <= 0xF4) return 4;
+    return 1;
+}
+
+void tokenize(const char *data, size_t n) {
+    const unsigned char *s = (const unsigned char *)data;
+    size_t i = 0;
+
+    // 先补完上一个缓冲区末尾被截断的 UTF-8 字符
+    if (utf8_carry_len > 0) {
+        int need = utf8_length(utf8_carry[0]);
+        while (utf8_carry_len < need && i < n && (s[i] & 0xC0) == 0x80) {
+            utf8_carry[utf8_carry_len++] = s[i++];
+        }
+        if (utf8_carry_len < need && i == n) return;
+
+        unsigned int cp;
+        if (utf8_carry_len == need && utf8_decode(utf8_carry, need, &cp)) {
+            unicode_char(cp);
+        } else {
+            for (int k = 0; k < utf8_carry_len; k++) raw_byte(utf8_carry[k]);
+        }
+        utf8_carry_len = 0;
+    }
+
+    // 纯 ASCII 缓冲区走查表快速路径
+    if (is_ascii(data + i, n - i)) {
+        for (; i < n; i++) ascii_char(s[i]);
+        return;
+    }
+
+    while (i < n) {
+        if (s[i] < 0x80) {
+            ascii_char(s[i++]);
+            continue;
+        }
+
+        unsigned int cp;
+        int len = utf8_decode(s + i, n - i, &cp);
+        if (len > 0) {
+            unicode_char(cp);
+            i += len;
+            continue;
+        }
+
+        // 缓冲区末尾只有半个字符：留到下一次
+        int need = utf8_length(s[i]);
+        if (need > 1 && n - i < (size_t)need) {
+            size_t k = i + 1;
+            while (k < n && (s[k] & 0xC0) == 0x80) k++;
+            if (k == n) {
+                utf8_carry_len = n - i;
+                memcpy(utf8_carry, s + i, utf8_carry_len);
+                return;
             }
         }
-        
-        if (has_letter) {
-            printf("%s 1\n", word);
+        raw_byte(s[i++]);
+    }
+}
+
+// 输入结束（或一帧结束）：输出最后一个单词
+void tokenize_flush() {
+    for (int k = 0; k < utf8_carry_len; k++) raw_byte(utf8_carry[k]);
+    utf8_carry_len = 0;
+    token_end();
+}
+
+/* ---------------------------------------------------------------------- */
+/* 日志字段类的 job：按行处理                                              */
+/* ---------------------------------------------------------------------- */
+
+char *field_line = NULL;
+size_t field_line_len = 0;
+size_t field_line_cap = 0;
+
+// 字段类 job 的 map 函数在 job 表里（job.c）
+void map_fields(const char *line, size_t len) {
+    job->map(line, len, &job_opts, emit_record);
+}
+
+// 字段类 job 需要整行，这里只保留未结束的一行
+void append_line(const char *data, size_t n) {
+    if (field_line_len + n > field_line_cap) {
+        size_t new_cap = field_line_cap ? field_line_cap : BUFFER_SIZE;
+        while (new_cap < field_line_len + n) new_cap *= 2;
+        field_line = realloc(field_line, new_cap);
+        if (!field_line) {
+            perror("realloc");
+            exit(1);
         }
-        
-        word = strtok(NULL, " \t\n\r\f\v.,;:!?\"()[]{}");
+        field_line_cap = new_cap;
+    }
+    memcpy(field_line + field_line_len, data, n);
+    field_line_len += n;
+}
+
+void feed_lines(const char *data, size_t n) {
+    const char *start = data;
+    const char *stop = data + n;
+    const char *end;
+    while ((end = memchr(start, '\n', stop - start)) != NULL) {
+        if (field_line_len > 0) {
+            append_line(start, end - start);
+            map_fields(field_line, field_line_len);
+            field_line_len = 0;
+        } else {
+            map_fields(start, end - start);
+        }
+        start = end + 1;
+    }
+    append_line(start, stop - start);
+}
+
+void map_input(const char *data, size_t n) {
+    if (!job->map) {
+        tokenize(data, n);
+    } else {
+        feed_lines(data, n);
+    }
+}
+
+void map_flush() {
+    if (!job->map) {
+        tokenize_flush();
+    } else if (field_line_len > 0) {
+        map_fields(field_line, field_line_len);
+        field_line_len = 0;
+    }
+}
+
+// 整数参数：整个字符串必须是 [min, max] 内的数，否则报错退出
+long long number_arg(const char *flag, const char *s, long long min, long long max) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno == ERANGE || v < min || v > max) {
+        fprintf(stderr, "Bad %s value: %s\n", flag, s);
+        exit(1);
     }
+    return v;
 }
 
-int main() {
-    // 设置stdout为无缓冲
-    setvbuf(stdout, NULL, _IONBF, 0);
+int main(int argc, char *argv[]) {
+    const char *job_name = "wordcount";
+    // -s 读停用词时就要用分词器
+    init_ascii_class();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            dict_mode = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            frame_mode = 1;
+        } else if (strcmp(argv[i], "-C") == 0) {
+            combine_mode = 1;
+        } else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            if (table_attach(atoi(argv[++i]), &table) < 0) {
+                perror("shared table");
+                return 1;
+            }
+            table_mode = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            job_name = argv[++i];
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            job_opts.key_field = number_arg("-k", argv[++i], 1, INT_MAX);
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            job_opts.value_field = number_arg("-v", argv[++i], 1, INT_MAX);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            job_opts.bucket_width = number_arg("-w", argv[++i], 1, LLONG_MAX);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            load_stop_words(argv[++i]);
+            filter_on = true;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            min_len = number_arg("-l", argv[++i], 0, INT_MAX);
+            filter_on = true;
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            max_len = number_arg("-L", argv[++i], 1, INT_MAX);
+            filter_on = true;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            char *list = strdup(argv[++i]);
+            for (char *p = strtok(list, ","); p && num_prefixes < 64; p = strtok(NULL, ",")) {
+                prefixes[num_prefixes++] = p;
+            }
+            filter_on = true;
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            int err = regcomp(&key_regex, argv[++i], REG_EXTENDED | REG_NOSUB);
+            if (err) {
+                char msg[256];
+                regerror(err, &key_regex, msg, sizeof(msg));
+                fprintf(stderr, "Bad regex: %s\n", msg);
+                return 1;
+            }
+            regex_on = true;
+            filter_on = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-j job] [-k field] [-v field] [-w width] [-s stopfile] [-l min]\n"
+                    "          [-L max] [-p prefix,...] [-x regex] [-M fd] [-C] [-d] [-f]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    job = find_job(job_name);
+    if (!job) {
+        fprintf(stderr, "Unknown job: %s\n", job_name);
+        list_jobs(stderr);
+        return 1;
+    }
+
+    // 输出全缓冲：帧模式下每帧结束时 fflush
+    setvbuf(stdout, NULL, _IOFBF, READ_SIZE);
     
-    char buffer[BUFFER_SIZE];
-    char line[BUFFER_SIZE * 2] = "";
+    static char buffer[READ_SIZE];
+    // 帧模式：当前帧还剩多少字节（-1 表示正在读帧头）
+    long frame_left = -1;
+    long header = 0;
     
     while (1) {
-        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer) - 1);
+        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
         if (n <= 0) {
             if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
                 continue;
@@ -466,40 +1025,39 @@ int main() {
             break;
         }
         
-        buffer[n] = '\0';
-        
-        // 处理输入，可能包含多行
-        char* start = buffer;
-        char* end;
-        
-        // 处理完整行
-        while ((end = strchr(start, '\n')) != NULL) {
-            *end = '\0';
-            
-            // 将当前行添加到累积行
-            if (strlen(line) + strlen(start) < sizeof(line) - 1) {
-                strcat(line, start);
-            }
-            
-            // 处理累积的行
-            extract_words(line);
-            
-            // 重置累积行
-            line[0] = '\0';
-            
-            start = end + 1;
+        if (!frame_mode) {
+            map_input(buffer, n);
+            continue;
         }
-        
-        // 将剩余部分添加到累积行
-        if (*start && strlen(line) + strlen(start) < sizeof(line) - 1) {
-            strcat(line, start);
+
+        // 帧格式 "<len>\n<payload>"，处理完一帧后输出 "." 作为确认
+        char *p = buffer;
+        char *stop = buffer + n;
+        while (p < stop) {
+            if (frame_left < 0) {
+                if (*p == '\n') {
+                    frame_left = header;
+                    header = 0;
+                } else if (isdigit((unsigned char)*p)) {
+                    header = header * 10 + (*p - '0');
+                }
+                p++;
+            } else {
+                long take = stop - p < frame_left ? stop - p : frame_left;
+                map_input(p, take);
+                frame_left -= take;
+                p += take;
+            }
+            if (frame_left == 0) {
+                map_flush();
+                emit_commit();
+                frame_left = -1;
+            }
         }
     }
     
-    // 处理剩余的累积行
-    if (line[0]) {
-        extract_words(line);
-    }
+    map_flush();
+    if (combine_mode) combine_flush();
     
     return 0;
-}
\ No newline at end of file
+}
@@ -1,3 +1,19 @@
+// Compile: gcc -O2 -pthread reducer.c job.c -o reducer
+// Run: ./reducer [-j job] [-t threads] [-s keys] [-n min] [-d] [-c checkpoint]
+//   -j  job from job.c; its fold combines values for the same key
+//   -t  threads for sorting and formatting the output (default: one per
+//       CPU this process may run on, up to 16; small tables always use one)
+//   -s  expected number of distinct keys: size the table and key arena for
+//       it up front (main sends the same hint mid-stream as "#<keys>")
+//   -n  only output keys whose final value (distinct count for distinct
+//       jobs) is at least min
+//   -d  dictionary-encoded input: "= <id> <word>" defines an id,
+//       "<id> <count>" adds to it
+//   -c  on a "!<epoch>" line, save the table to this file; if the file
+//       already exists at startup, resume from it
+// A "." input line (daemon mode) prints the results so far, then "." and
+// clears the counts for the next job.
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,19 +21,148 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <limits.h>
+
+#include "job.h"
 
 #define MAX_WORD_LEN 256
 #define BUFFER_SIZE 4096
+#define MAX_THREADS 16
+#define PARALLEL_MIN 65536      // fewer entries than this finalize on one thread
+#define INITIAL_SLOTS 1024
+#define ARENA_BLOCK (64 * 1024)
+#define HINT_KEY_BYTES 16       // arena bytes reserved per hinted key
+#define MAX_HINT (1 << 28)
 
 struct WordCount {
-    char word[MAX_WORD_LEN];
-    int count;
-    struct WordCount *next;
+    char *word;                 // in the key arena
+    long long count;
+    int seen;                   // count holds a value (dict ids start empty)
+    unsigned int hash;
 };
 
-struct WordCount *word_counts = NULL;
+// Entries live in one dense array, found by key through an open-addressing
+// index of entry numbers (-1 = empty, linear probing, at most half full).
+// Keys are copied into large arena blocks and never freed.
+struct WordCount *entries = NULL;
+int num_entries = 0;
+int entries_cap = 0;
+int *slots = NULL;
+unsigned int num_slots = 0;
+
+char *arena = NULL;
+size_t arena_left = 0;
+size_t arena_block = ARENA_BLOCK;
+
+int dict_mode = 0;
+const char *checkpoint_path = NULL;
+const struct job *job;
+int num_threads = 0;
+long long min_count = LLONG_MIN;
+
+// Dictionary mode: ids are dense, so records index straight into this array
+int *by_id = NULL;
+int by_id_cap = 0;
+
+// FNV-1a
+unsigned int hash_key(const char *word, int len) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+char *arena_copy(const char *word, int len) {
+    if ((size_t)len + 1 > arena_left) {
+        size_t size = arena_block > (size_t)len + 1 ? arena_block : (size_t)len + 1;
+        arena = malloc(size);
+        if (!arena) {
+            perror("malloc");
+            exit(1);
+        }
+        arena_left = size;
+        arena_block = ARENA_BLOCK;
+    }
+    char *copy = arena;
+    memcpy(copy, word, len);
+    copy[len] = '\0';
+    arena += len + 1;
+    arena_left -= len + 1;
+    return copy;
+}
+
+// Make room for n entries, so the next n - num_entries new keys cause no
+// further growth or rehashing
+void reserve(int n) {
+    if (n > entries_cap) {
+        entries = realloc(entries, (size_t)n * sizeof(struct WordCount));
+        if (!entries) {
+            perror("realloc");
+            exit(1);
+        }
+        entries_cap = n;
+    }
+
+    unsigned int want = INITIAL_SLOTS;
+    while (want < 2u * (unsigned int)n) want *= 2;
+    if (want <= num_slots) return;
+
+    int *new_slots = malloc((size_t)want * sizeof(int));
+    if (!new_slots) {
+        perror("malloc");
+        exit(1);
+    }
+    memset(new_slots, 0xff, (size_t)want * sizeof(int));
+    for (int i = 0; i < num_entries; i++) {
+        unsigned int s = entries[i].hash & (want - 1);
+        while (new_slots[s] != -1) s = (s + 1) & (want - 1);
+        new_slots[s] = i;
+    }
+    free(slots);
+    slots = new_slots;
+    num_slots = want;
+}
+
+// Sizing hint from main: about n distinct keys will arrive in total
+void size_hint(long n) {
+    if (n <= num_entries || n > MAX_HINT) return;
+    reserve(n);
+    size_t arena_want = (size_t)(n - num_entries) * HINT_KEY_BYTES;
+    if (arena_want > arena_left && arena_want > arena_block) arena_block = arena_want;
+}
+
+// Entry number for a key, adding an empty entry if it is new
+int find_or_add(const char *word, int len) {
+    if (num_entries == entries_cap || 2u * (num_entries + 1) > num_slots) {
+        reserve(num_entries ? num_entries * 2 : INITIAL_SLOTS / 2);
+    }
+
+    unsigned int hash = hash_key(word, len);
+    unsigned int mask = num_slots - 1;
+    unsigned int s = hash & mask;
+    while (slots[s] != -1) {
+        struct WordCount *w = &entries[slots[s]];
+        if (w->hash == hash && strcmp(w->word, word) == 0) {
+            return slots[s];
+        }
+        s = (s + 1) & mask;
+    }
+
+    int i = num_entries++;
+    entries[i].word = arena_copy(word, len);
+    entries[i].count = 0;
+    entries[i].seen = 0;
+    entries[i].hash = hash;
+    slots[s] = i;
+    return i;
+}
 
-void add_word(const char *word, int count) {
+void add_word(const char *word, long long count) {
     // Skip empty words
     if (!word || word[0] == '\0') {
         return;
@@ -39,21 +184,151 @@ void add_word(const char *word, int count) {
         return;
     }
     
-    struct WordCount *curr = word_counts;
-    while (curr) {
-        if (strcmp(curr->word, normalized) == 0) {
-            curr->count += count;
-            return;
+    int i = find_or_add(normalized, len);
+    struct WordCount *w = &entries[i];
+    w->count = w->seen ? job->fold(w->count, count) : count;
+    w->seen = 1;
+}
+
+void define_word(int id, const char *word) {
+    if (id < 0) return;
+    if (id >= by_id_cap) {
+        int new_cap = by_id_cap ? by_id_cap : 1024;
+        while (new_cap <= id) new_cap *= 2;
+        by_id = realloc(by_id, new_cap * sizeof(int));
+        if (!by_id) {
+            perror("realloc");
+            exit(1);
         }
-        curr = curr->next;
+        memset(by_id + by_id_cap, 0xff, (new_cap - by_id_cap) * sizeof(int));
+        by_id_cap = new_cap;
+    }
+
+    char copy[MAX_WORD_LEN];
+    strncpy(copy, word, MAX_WORD_LEN - 1);
+    copy[MAX_WORD_LEN - 1] = '\0';
+    by_id[id] = find_or_add(copy, strlen(copy));
+}
+
+void add_by_id(int id, long long count) {
+    if (id >= 0 && id < by_id_cap && by_id[id] >= 0) {
+        struct WordCount *w = &entries[by_id[id]];
+        w->count = w->seen ? job->fold(w->count, count) : count;
+        w->seen = 1;
+    }
+}
+
+// Snapshot the table as "<id> <seen> <count> <word>" lines. Written to a temp
+// file and renamed so a crash mid-write leaves the previous one intact.
+void write_checkpoint(int epoch) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint_path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        perror("checkpoint");
+        return;
+    }
+
+    fprintf(f, "epoch %d\n", epoch);
+    if (dict_mode) {
+        for (int id = 0; id < by_id_cap; id++) {
+            if (by_id[id] >= 0) {
+                struct WordCount *w = &entries[by_id[id]];
+                fprintf(f, "%d %d %lld %s\n", id, w->seen, w->count, w->word);
+            }
+        }
+    } else {
+        for (int i = 0; i < num_entries; i++) {
+            fprintf(f, "-1 1 %lld %s\n", entries[i].count, entries[i].word);
+        }
+    }
+
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        perror("checkpoint");
+        fclose(f);
+        return;
+    }
+    fclose(f);
+    rename(tmp, checkpoint_path);
+}
+
+void load_checkpoint() {
+    FILE *f = fopen(checkpoint_path, "r");
+    if (!f) return;
+
+    char line[MAX_WORD_LEN + 64];
+    while (fgets(line, sizeof(line), f)) {
+        int id, seen, n;
+        long long count;
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%d %d %lld %n", &id, &seen, &count, &n) != 3) continue;
+        if (dict_mode) {
+            define_word(id, line + n);
+            if (seen) add_by_id(id, count);
+        } else {
+            add_word(line + n, count);
+        }
+    }
+    fclose(f);
+}
+
+// Between daemon jobs: forget the values but keep every key, the index and
+// the dictionary ids, so the next job starts with a warm table
+void clear_counts() {
+    for (int i = 0; i < num_entries; i++) {
+        entries[i].count = 0;
+        entries[i].seen = 0;
+    }
+}
+
+void output_results();
+
+// Handle one complete input line
+void process_line(char *line) {
+    // "." from the daemon ends a job: print its results and a "." line
+    if (line[0] == '.' && line[1] == '\0') {
+        output_results();
+        fputs(".\n", stdout);
+        clear_counts();
+        return;
+    }
+
+    // Control line from main: "!<epoch>" requests a checkpoint
+    if (line[0] == '!' && !strchr(line, ' ')) {
+        if (checkpoint_path) write_checkpoint(atoi(line + 1));
+        return;
+    }
+
+    // "#<n>": main estimates about n distinct keys for this reducer
+    if (line[0] == '#' && !strchr(line, ' ')) {
+        size_hint(atol(line + 1));
+        return;
+    }
+
+    if (dict_mode) {
+        char *end;
+        if (line[0] == '=' && line[1] == ' ') {
+            long id = strtol(line + 2, &end, 10);
+            if (end != line + 2 && *end == ' ') {
+                define_word(id, end + 1);
+            }
+        } else {
+            long id = strtol(line, &end, 10);
+            if (end != line && *end == ' ') {
+                add_by_id(id, strtoll(end + 1, NULL, 10));
+            }
+        }
+        return;
+    }
+
+    char *key;
+    long long value;
+    if (job->codec->parse(line, &key, &value)) {
+        char word[MAX_WORD_LEN];
+        strncpy(word, key, MAX_WORD_LEN - 1);
+        word[MAX_WORD_LEN - 1] = '\0';
+        add_word(word, value);
     }
-    
-    struct WordCount *new_word = malloc(sizeof(struct WordCount));
-    strncpy(new_word->word, normalized, MAX_WORD_LEN - 1);
-    new_word->word[MAX_WORD_LEN - 1] = '\0';
-    new_word->count = count;
-    new_word->next = word_counts;
-    word_counts = new_word;
 }
 
 int compare(struct WordCount *a, struct WordCount *b) {
@@ -112,76 +387,221 @@ void mergeSort(struct WordCount **arr, int left, int right) {
     }
 }
 
+// Finalization: entries are split into key-range shards that are sorted and
+// formatted on separate threads, then written out in shard order
+struct Shard {
+    struct WordCount **arr;
+    int count;
+    char *out;
+    size_t out_len, out_cap;
+};
+
+// Leading two bytes as one number that orders like strcmp. Bytes up to '\t'
+// count as 0 so all "key\t..." entries of a distinct job share a shard.
+unsigned int shard_key(const char *word) {
+    unsigned char b0 = word[0];
+    unsigned char b1 = b0 ? word[1] : 0;
+    if (b0 <= '\t') return 0;
+    if (b1 <= '\t') b1 = 0;
+    return b0 << 8 | b1;
+}
+
+void shard_printf(struct Shard *s, const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        va_start(ap, fmt);
+        int n = vsnprintf(s->out + s->out_len, s->out_cap - s->out_len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (s->out_len + n < s->out_cap) {
+            s->out_len += n;
+            return;
+        }
+        s->out_cap = s->out_cap ? s->out_cap * 2 : BUFFER_SIZE;
+        s->out = realloc(s->out, s->out_cap);
+        if (!s->out) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+}
+
+// Append one output line in the job's codec
+void shard_record(struct Shard *s, const char *key, long long value) {
+    char line[MAX_WORD_LEN + 32];
+    int n = job->codec->format(line, sizeof(line), key, value);
+    if (n < 0 || n >= (int)sizeof(line)) return;
+    shard_printf(s, "%.*s", n, line);
+}
+
+void *finalize_shard(void *arg) {
+    struct Shard *s = arg;
+    struct WordCount **arr = s->arr;
+    int count = s->count;
+
+    mergeSort(arr, 0, count - 1);
+
+    if (job->distinct) {
+        // Keys are "key\tvalue" and sorting keeps each key's values
+        // together: output the number of distinct values per key
+        for (int i = 0; i < count; ) {
+            int prefix = strcspn(arr[i]->word, "\t");
+            int j = i + 1;
+            while (j < count && strncmp(arr[j]->word, arr[i]->word, prefix) == 0 &&
+                   arr[j]->word[prefix] == '\t') {
+                j++;
+            }
+            if (j - i >= min_count) {
+                char key[MAX_WORD_LEN];
+                memcpy(key, arr[i]->word, prefix);
+                key[prefix] = '\0';
+                shard_record(s, key, j - i);
+            }
+            i = j;
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            if (arr[i]->count >= min_count) {
+                shard_record(s, arr[i]->word, arr[i]->count);
+            }
+        }
+    }
+    return NULL;
+}
+
 void output_results() {
     // Count the number of words
     int count = 0;
-    struct WordCount *curr = word_counts;
-    while (curr) {
-        count++;
-        curr = curr->next;
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].seen) count++;
     }
-    
-    // Create an array of pointers to WordCount structs
-    struct WordCount **arr = malloc(count * sizeof(struct WordCount *));
-    curr = word_counts;
-    for (int i = 0; i < count; i++) {
-        arr[i] = curr;
-        curr = curr->next;
+
+    int threads = count < PARALLEL_MIN ? 1 : num_threads;
+
+    // Cut the 16-bit key prefixes, highest first (output is descending),
+    // into ranges holding about count / threads entries each
+    static int shard_of[1 << 16];
+    int *hist = calloc(1 << 16, sizeof(int));
+    if (!hist) {
+        perror("calloc");
+        exit(1);
     }
-    
-    // Sort the array
-    mergeSort(arr, 0, count - 1);
-    
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].seen) hist[shard_key(entries[i].word)]++;
+    }
+
+    struct Shard shards[MAX_THREADS];
+    memset(shards, 0, sizeof(shards));
+    int shard = 0, assigned = 0;
+    for (int key = (1 << 16) - 1; key >= 0; key--) {
+        if (shard < threads - 1 && assigned >= (long long)(shard + 1) * count / threads) {
+            shard++;
+        }
+        shard_of[key] = shard;
+        shards[shard].count += hist[key];
+        assigned += hist[key];
+    }
+    free(hist);
+
+    // Create an array of pointers to WordCount structs, grouped by shard
+    struct WordCount **arr = malloc((count ? count : 1) * sizeof(struct WordCount *));
+    int offset = 0;
+    for (int i = 0; i < threads; i++) {
+        shards[i].arr = arr + offset;
+        offset += shards[i].count;
+        shards[i].count = 0;
+    }
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].seen) {
+            struct Shard *s = &shards[shard_of[shard_key(entries[i].word)]];
+            s->arr[s->count++] = &entries[i];
+        }
+    }
+
+    // Sort and format the shards in parallel; this thread takes the first
+    pthread_t tids[MAX_THREADS];
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, finalize_shard, &shards[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    finalize_shard(&shards[0]);
+
     // Output the sorted results
-    for (int i = 0; i < count; i++) {
-        printf("%s %d\n", arr[i]->word, arr[i]->count);
-        fflush(stdout);
+    for (int i = 0; i < threads; i++) {
+        if (i > 0) pthread_join(tids[i], NULL);
+        fwrite(shards[i].out, 1, shards[i].out_len, stdout);
+        free(shards[i].out);
     }
-    
+
     free(arr);
 }
 
-int main() {
-    // Set stdin to non-blocking
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
-    
+int main(int argc, char *argv[]) {
+    const char *job_name = "wordcount";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            dict_mode = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            job_name = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            size_hint(atol(argv[++i]));
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            char *end;
+            errno = 0;
+            min_count = strtoll(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || errno == ERANGE) {
+                fprintf(stderr, "Bad -n value: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-j job] [-t threads] [-s keys] [-n min] [-d] [-c checkpoint]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_threads <= 0) {
+        // Count our affinity, not the host: under -A main pins each reducer
+        // to its node or core, and its threads can't run anywhere else
+        cpu_set_t cpus;
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) num_threads = CPU_COUNT(&cpus);
+        else num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
+
+    job = find_job(job_name);
+    if (!job) {
+        fprintf(stderr, "Unknown job: %s\n", job_name);
+        return 1;
+    }
+
+    if (checkpoint_path) {
+        load_checkpoint();
+    }
+
+    // stdin stays blocking: under ./worker it is the same socket as stdout,
+    // so O_NONBLOCK here would make our writes non-blocking too
+
     // Set stdout to unbuffered
     setvbuf(stdout, NULL, _IONBF, 0);
     
-    char buffer[BUFFER_SIZE];
     char partial_line[BUFFER_SIZE] = "";
     int partial_len = 0;
     int eof_reached = 0;
-    int no_data_count = 0;
     
-    while (!eof_reached || partial_len > 0) {
-        ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    while (!eof_reached) {
+        // Read straight after the unfinished line so records that straddle
+        // two reads are reassembled instead of dropped
+        ssize_t n = read(STDIN_FILENO, partial_line + partial_len,
+                         sizeof(partial_line) - 1 - partial_len);
         
         if (n > 0) {
-            no_data_count = 0;
-            // Process the input
-            char word[MAX_WORD_LEN];
-            int count;
-            
-            // Append new data to partial line
-            if (partial_len + n >= sizeof(partial_line)) {
-                // Buffer overflow, process partial line first
-                char *newline = strchr(partial_line, '\n');
-                if (newline) {
-                    *newline = '\0';
-                    if (sscanf(partial_line, "%255s %d", word, &count) == 2) {
-                        add_word(word, count);
-                    }
-                    memmove(partial_line, newline + 1, partial_len - (newline - partial_line + 1));
-                    partial_len -= (newline - partial_line + 1);
-                } else {
-                    // No newline in partial line, must be corrupted
-                    partial_len = 0;
-                }
-            }
-            
-            memcpy(partial_line + partial_len, buffer, n);
             partial_len += n;
             partial_line[partial_len] = '\0';
             
@@ -190,35 +610,28 @@ int main() {
             char *newline;
             while ((newline = strchr(start, '\n'))) {
                 *newline = '\0';
-                char *space = strrchr(start, ' ');
-                if (space) {
-                    *space = '\0';
-                    count = atoi(space + 1);
-                    strncpy(word, start, MAX_WORD_LEN - 1);
-                    word[MAX_WORD_LEN - 1] = '\0';
-                    add_word(word, count);
-                }
+                process_line(start);
                 start = newline + 1;
             }
             
             // Move remaining partial line to beginning
             partial_len = partial_line + partial_len - start;
-            if (partial_len > 0) {
+            if (partial_len == sizeof(partial_line) - 1) {
+                // No newline in a full buffer, must be corrupted
+                partial_len = 0;
+            } else if (partial_len > 0) {
                 memmove(partial_line, start, partial_len);
             }
             
         } else if (n == 0) {
             eof_reached = 1;
-        } else {
-            if (errno != EAGAIN && errno != EINTR) {
-                perror("read");
-                exit(1);
-            }
-            no_data_count++;
-            if (no_data_count > 1000) {
-                usleep(1000); // Sleep 1ms if no data for a while
-                no_data_count = 0;
+            if (partial_len > 0) {
+                partial_line[partial_len] = '\0';
+                process_line(partial_line);
             }
+        } else if (errno != EINTR) {
+            perror("read");
+            exit(1);
         }
     }
     
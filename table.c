@@ -0,0 +1,142 @@
+// Lock-free shared-memory table for the -M reduce mode (see table.h)
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "table.h"
+#include "job.h"
+
+#define HEADER_SIZE 64                  // keeps the slots off the header's cache line
+
+static size_t mapping_size(uint64_t capacity) {
+    return HEADER_SIZE + capacity * sizeof(uint64_t) + capacity * TABLE_ARENA_PER_SLOT;
+}
+
+static int table_map(int fd, size_t size, struct table *t) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) return -1;
+    t->header = base;
+    t->slots = (void *)((char *)base + HEADER_SIZE);
+    t->arena = (char *)(t->slots + t->header->capacity);
+    return 0;
+}
+
+int table_create(uint64_t slots, struct table *t) {
+    if (slots > TABLE_MAX_SLOTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t capacity = 1024;
+    while (capacity < slots) capacity *= 2;
+
+    // The file is sparse: only the slots and arena pages touched get memory
+    int fd = memfd_create("mapreduce-table", 0);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, mapping_size(capacity)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct table_header header = {capacity, capacity * TABLE_ARENA_PER_SLOT};
+    // Offset 0 is never an entry, so a slot word is never 0
+    atomic_init(&header.arena_used, 8);
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        table_map(fd, mapping_size(capacity), t) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int table_attach(int fd, struct table *t) {
+    struct table_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        if (errno == 0) errno = EINVAL;
+        return -1;
+    }
+    return table_map(fd, mapping_size(header.capacity), t);
+}
+
+// FNV-1a
+static uint64_t table_hash(const char *key, int len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Write a new entry into the arena; returns its offset / 8, or 0 when the
+// arena is full
+static uint64_t new_entry(struct table *t, const char *key, int len, long long value) {
+    uint64_t size = (sizeof(struct table_entry) + len + 1 + 7) & ~7ULL;
+    uint64_t off = atomic_fetch_add_explicit(&t->header->arena_used, size, memory_order_relaxed);
+    if (off + size > t->header->arena_size) return 0;
+
+    struct table_entry *e = (struct table_entry *)(t->arena + off);
+    atomic_store_explicit(&e->value, value, memory_order_relaxed);
+    e->len = len;
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    return off / 8;
+}
+
+static void fold_value(struct table_entry *e, long long value,
+                       long long (*fold)(long long, long long)) {
+    if (fold == fold_sum) {
+        atomic_fetch_add_explicit(&e->value, value, memory_order_relaxed);
+        return;
+    }
+    long long old = atomic_load_explicit(&e->value, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&e->value, &old, fold(old, value),
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+int table_add(struct table *t, const char *key, int len, long long value,
+              long long (*fold)(long long acc, long long value)) {
+    uint64_t h = table_hash(key, len);
+    uint64_t tag = h & 0xFFFFFFFF00000000ULL;
+    uint64_t mask = t->header->capacity - 1;
+    uint64_t mine = 0;          // our entry's slot word, once written
+
+    for (uint64_t i = h & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+        uint64_t slot = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+        if (slot == 0) {
+            if (!mine) {
+                // Past 3/4 full the probe sequences get too long
+                if (atomic_load_explicit(&t->header->keys, memory_order_relaxed) >= mask / 4 * 3) break;
+                uint64_t off = new_entry(t, key, len, value);
+                if (!off) break;
+                mine = tag | off;
+            }
+            // Release publishes the entry written above along with the slot
+            if (atomic_compare_exchange_strong_explicit(&t->slots[i], &slot, mine,
+                                                        memory_order_release, memory_order_acquire)) {
+                atomic_fetch_add_explicit(&t->header->keys, 1, memory_order_relaxed);
+                return 1;
+            }
+            // Another mapper took the slot first; slot now holds its word.
+            // If that was our key, our entry is left unused in the arena.
+        }
+        if ((slot & 0xFFFFFFFF00000000ULL) == tag) {
+            struct table_entry *e = (struct table_entry *)(t->arena + (slot & 0xFFFFFFFF) * 8);
+            if (e->len == (uint32_t)len && memcmp(e->key, key, len) == 0) {
+                fold_value(e, value, fold);
+                return 1;
+            }
+        }
+    }
+    atomic_store(&t->header->full, 1);
+    return 0;
+}
+
+struct table_entry *table_entry(struct table *t, uint64_t i) {
+    uint64_t slot = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+    if (!slot) return NULL;
+    return (struct table_entry *)(t->arena + (slot & 0xFFFFFFFF) * 8);
+}
@@ -0,0 +1,59 @@
+// Shared-memory table for the -M reduce mode, used by main and mapper.
+//
+// main creates the table in a memfd that every mapper inherits, and the
+// mappers fold their records straight into it instead of writing them out:
+// no shuffle and no reducers. Everything is lock-free, so any number of
+// mappers can insert at once:
+//   - the slots are an open-addressing array of 64-bit words, 0 when empty,
+//     else the top 32 bits of the key's hash and the entry's arena offset / 8
+//   - an entry (value, length, key bytes) is written into the append-only
+//     arena, claimed with a fetch-add, then published by CAS on the slot
+//   - values are folded with a fetch-add for sums and a CAS loop otherwise
+// The table doesn't grow. It is sized up front, and an insert into a full
+// table fails and sets the header's full flag for main to report.
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define TABLE_MAX_SLOTS (1ULL << 28)
+#define TABLE_ARENA_PER_SLOT 64         // arena bytes reserved per slot
+
+struct table_header {
+    uint64_t capacity;                  // slots, a power of two
+    uint64_t arena_size;
+    _Atomic uint64_t arena_used;
+    _Atomic uint64_t keys;
+    _Atomic int full;
+};
+
+struct table_entry {
+    _Atomic long long value;
+    uint32_t len;
+    char key[];                         // len bytes and a '\0'
+};
+
+// One process's view of the mapping
+struct table {
+    struct table_header *header;
+    _Atomic uint64_t *slots;
+    char *arena;
+};
+
+// Create a table of at least slots slots in a new memfd that stays open
+// across exec; returns the fd, or -1 with errno set (EINVAL past
+// TABLE_MAX_SLOTS)
+int table_create(uint64_t slots, struct table *t);
+// Map the table behind an inherited fd; returns 0, or -1 with errno set
+int table_attach(int fd, struct table *t);
+
+// Fold value into key's entry, adding the key if it's new. Returns 0 when
+// the table or its arena is full.
+int table_add(struct table *t, const char *key, int len, long long value,
+              long long (*fold)(long long acc, long long value));
+
+// The entry in slot i, or NULL if the slot is empty
+struct table_entry *table_entry(struct table *t, uint64_t i);
+
+#endif
@@ -0,0 +1,81 @@
+#!/bin/bash
+# Daemon mode (-D/-U): two jobs submitted to one daemon each get their own
+# counts, with nothing carried over from the first job into the second.
+# SIGTERM while a client is still sending lets that job finish on its whole
+# input, then stops the daemon and removes its socket.
+#
+# Usage: bash tests/test_daemon.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+tmp=$(mktemp -d)
+daemon=""
+trap '[[ -n $daemon ]] && kill -KILL "$daemon" 2>/dev/null; rm -rf "$tmp"' EXIT
+
+# result <name> <expected> <actual>
+result() {
+	if [[ $3 == "$2" ]]; then
+		echo "PASS $1"
+	else
+		echo "FAIL $1: expected '$2' but got '$3'"
+		((failures++))
+	fi
+}
+
+# check_daemon <name> <daemon args...>
+check_daemon() {
+	local name=$1
+	shift
+	local sock=$tmp/sock
+	./main -D "$sock" "$@" 2>"$tmp/err" &
+	daemon=$!
+	for ((i = 0; i < 50; i++)); do
+		grep -q "^Daemon listening" "$tmp/err" && break
+		sleep 0.1
+	done
+
+	# The second job shares words with the first, so leftover counts show up
+	./main -U "$sock" <tests/input1.txt >/dev/null 2>&1
+	result "$name: first job" "$(./main "$@" <tests/input1.txt 2>/dev/null | sort)" \
+		"$(./main -U "$sock" <tests/input1.txt 2>/dev/null | sort)"
+	result "$name: second job excludes the first's counts" \
+		"$(./main "$@" <tests/input2.txt 2>/dev/null | sort)" \
+		"$(./main -U "$sock" <tests/input2.txt 2>/dev/null | sort)"
+
+	# Stop the daemon while a client is half way through sending its job
+	{
+		cat tests/input1.txt
+		sleep 1
+		echo
+		cat tests/input2.txt
+	} | ./main -U "$sock" 2>/dev/null | sort >"$tmp/streamed" &
+	local client=$!
+	sleep 0.5
+	kill -TERM "$daemon"
+	wait "$client"
+	result "$name: a job being sent at SIGTERM gets its whole input" \
+		"$({ cat tests/input1.txt; echo; cat tests/input2.txt; } | ./main "$@" 2>/dev/null | sort)" \
+		"$(cat "$tmp/streamed")"
+
+	local stopped=no
+	for ((i = 0; i < 50; i++)); do
+		if ! kill -0 "$daemon" 2>/dev/null; then
+			stopped=yes
+			break
+		fi
+		sleep 0.1
+	done
+	wait "$daemon" 2>/dev/null
+	[[ $stopped == yes && -e $sock ]] && stopped="yes, but the socket is left"
+	result "$name: SIGTERM stops the daemon" yes "$stopped"
+	daemon=""
+}
+
+check_daemon "daemon"
+check_daemon "daemon with -d" -d
+check_daemon "daemon with -C" -C
+
+echo "$failures failure(s)"
+exit $((failures > 0))
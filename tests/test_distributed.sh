@@ -0,0 +1,125 @@
+#!/bin/bash
+# Distributed mode on one machine: start worker agents on localhost, check
+# that ./main -H gives the same result as the local pipeline, and optionally
+# measure how throughput scales with the number of workers.
+#
+# Usage: bash tests/test_distributed.sh [-n workers] [-s size] [-F "main flags"]
+#   -n  workers for the correctness runs and the largest scaling run (default 3)
+#   -s  corpus size for the scaling run, e.g. 100M (default: skip it)
+#   -F  flags for the scaling runs (default "-C")
+
+cd "$(dirname "$0")/.."
+
+max_workers=3
+size=""
+scale_flags="-C"
+
+while getopts "n:s:F:" opt; do
+	case $opt in
+	n) max_workers=$OPTARG ;;
+	s) size=$OPTARG ;;
+	F) scale_flags=$OPTARG ;;
+	*) echo "Usage: $0 [-n workers] [-s size] [-F main-flags]" >&2; exit 1 ;;
+	esac
+done
+
+make -s all >&2 || exit 1
+tmp=$(mktemp -d)
+worker_pids=()
+hosts=""
+
+stop_workers() {
+	((${#worker_pids[@]})) && kill "${worker_pids[@]}" 2>/dev/null
+	wait 2>/dev/null
+	worker_pids=()
+	hosts=""
+}
+trap 'stop_workers; rm -rf "$tmp"' EXIT
+
+# start_workers <n>: workers on free ports, listed in $hosts for -H
+start_workers() {
+	stop_workers
+	for ((w = 0; w < $1; w++)); do
+		./worker -p 0 2>"$tmp/worker$w.log" &
+		worker_pids+=($!)
+		local port=""
+		for ((t = 0; t < 100; t++)); do
+			port=$(sed -n 's/^Worker listening on .* port //p' "$tmp/worker$w.log")
+			[[ -n $port ]] && break
+			sleep 0.05
+		done
+		if [[ -z $port ]]; then
+			echo "Worker $w did not start" >&2
+			exit 1
+		fi
+		hosts+="${hosts:+,}127.0.0.1:$port"
+	done
+}
+
+failures=0
+
+# check <name> <input> <flags...>: remote result must match the local one
+check() {
+	local name=$1 input=$2
+	shift 2
+	./main "$@" <"$input" 2>/dev/null | sort >"$tmp/local"
+	./main "$@" -H "$hosts" <"$input" 2>/dev/null | sort >"$tmp/remote"
+	if cmp -s "$tmp/local" "$tmp/remote" && [[ -s $tmp/local ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name"
+		((failures++))
+	fi
+}
+
+start_workers "$max_workers"
+for input in tests/input*.txt; do
+	name=$(basename "$input" .txt)
+	check "$name" "$input"
+	check "$name -d -m 5 -r 3" "$input" -d -m 5 -r 3
+	check "$name -f -C" "$input" -f -C
+	check "$name -f -d" "$input" -f -d
+done
+
+# A peer must not be able to make a reducer checkpoint into any path
+port=${hosts%%,*}
+port=${port##*:}
+if exec 3<>"/dev/tcp/127.0.0.1/$port"; then
+	printf 'reducer -c %s\n!1\n' "$tmp/pwned" >&3
+	cat <&3 >/dev/null 2>&1
+	exec 3<&-
+fi
+if [[ -e $tmp/pwned ]]; then
+	echo "FAIL worker refuses -c"
+	((failures++))
+else
+	echo "PASS worker refuses -c"
+fi
+
+if [[ -n $size ]]; then
+	corpus=bench/data/zipf-$size-42.txt
+	if [[ ! -s $corpus ]]; then
+		make -s bench/gen_corpus >&2 || exit 1
+		mkdir -p bench/data
+		bench/gen_corpus zipf "$size" 42 >"$corpus"
+	fi
+	bytes=$(stat -c %s "$corpus")
+	expected=$(./main $scale_flags <"$corpus" 2>/dev/null | sort | md5sum)
+
+	for ((n = 1; n <= max_workers; n *= 2)); do
+		start_workers "$n"
+		start=$(date +%s%N)
+		result=$(./main $scale_flags -m $((2 * n)) -r "$n" -H "$hosts" <"$corpus" 2>/dev/null | sort | md5sum)
+		ms=$((($(date +%s%N) - start) / 1000000))
+		status=PASS
+		if [[ $result != "$expected" ]]; then
+			status=FAIL
+			((failures++))
+		fi
+		awk -v n="$n" -v b="$bytes" -v ms="$ms" -v s="$status" 'BEGIN {
+			printf "%s %d worker(s): %d ms, %.1f MB/s\n", s, n, ms, (ms > 0 ? b / 1048576 / (ms / 1000) : 0) }'
+	done
+fi
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,74 @@
+#!/bin/bash
+# Fault-tolerant mode (-f): kill a mapper and then a reducer while a run is
+# in progress, and check the output still equals a clean run's and that
+# both restarts were logged.
+#
+# Usage: bash tests/test_fault.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# A few MB of text with enough distinct words to keep every reducer busy
+for ((i = 0; i < 20000; i++)); do
+	echo "alpha beta w$((i % 997)) gamma w$((i % 31)) delta w$i"
+done >"$tmp/input"
+size=$(stat -c %s "$tmp/input")
+half=$((size / 2))
+
+# kill_child <main pid> <name>: SIGKILL one of main's children called name
+kill_child() {
+	local pid
+	pid=$(pgrep -P "$1" -x "$2" | head -n 1)
+	[[ -n $pid ]] && kill -KILL "$pid"
+}
+
+# check_fault <name> <main args...>: feed half the input, kill a mapper,
+# feed a quarter more, kill a reducer, feed the rest, then compare
+check_fault() {
+	local name=$1
+	shift
+	./main "$@" <"$tmp/input" 2>/dev/null | sort >"$tmp/expected"
+
+	mkfifo "$tmp/fifo"
+	./main -f "$@" <"$tmp/fifo" >"$tmp/out" 2>"$tmp/err" &
+	local pid=$!
+	{
+		head -c "$half" "$tmp/input"
+		sleep 1
+		kill_child "$pid" mapper
+		sleep 1
+		tail -c +$((half + 1)) "$tmp/input" | head -c $((size / 4))
+		sleep 1
+		kill_child "$pid" reducer
+		sleep 1
+		tail -c +$((half + size / 4 + 1)) "$tmp/input"
+	} >"$tmp/fifo"
+	wait "$pid"
+	local status=$?
+	rm -f "$tmp/fifo"
+
+	if [[ $status -ne 0 ]]; then
+		echo "FAIL $name: ./main -f exited with status $status"
+		((failures++))
+	elif ! grep -q "^Mapper [0-9]* failed, re-running" "$tmp/err" ||
+		! grep -q "^Reducer [0-9]* failed, restarting" "$tmp/err"; then
+		echo "FAIL $name: a killed task was not restarted"
+		((failures++))
+	elif ! sort "$tmp/out" | cmp -s - "$tmp/expected"; then
+		echo "FAIL $name: output differs from a clean run"
+		((failures++))
+	else
+		echo "PASS $name"
+	fi
+}
+
+check_fault "kill a mapper then a reducer"
+check_fault "kill a mapper then a reducer with -d" -d
+check_fault "kill a mapper then a reducer with -C" -C
+
+echo "$failures failure(s)"
+exit $((failures > 0))
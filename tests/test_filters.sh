@@ -0,0 +1,57 @@
+#!/bin/bash
+# Mapper word filters: stop words are normalized by the tokenizer's own
+# rules, so punctuated and non-ASCII stop words match the words they name,
+# and bad filter options (including -l/-L/-n values that aren't integers)
+# fail the run before any task starts.
+#
+# Usage: bash tests/test_filters.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+
+# check <name> <expected> <main args...>: sorted output of ./main must match
+check() {
+	local name=$1 expected=$2
+	shift 2
+	local output
+	output=$(./main "$@" 2>/dev/null | sort)
+	if [[ $output == "$expected" ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: expected '$expected' but got '$output'"
+		((failures++))
+	fi
+}
+
+check "stop words with punctuation and non-ASCII letters" 'alles 1
+cat 1
+dogs 1
+panic 1
+the 2' -s tests/stopwords_filters.txt <tests/input_filters.txt
+
+# check_fails <name> <main args...>: ./main must exit non-zero with no output
+check_fails() {
+	local name=$1
+	shift
+	local output
+	output=$(./main "$@" <tests/input1.txt 2>/dev/null)
+	if [[ $? -ne 0 && -z $output ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: exited zero or printed output"
+		((failures++))
+	fi
+}
+
+check_fails "missing stop file" -s /nonexistent
+check_fails "invalid regex" -x '('
+check_fails "word filter on a field job" -j sum -k 1 -v 2 -l 3
+check_fails "non-numeric -l" -l abc
+check_fails "trailing characters in -n" -n 2x
+check_fails "-L below -l" -l 5 -L 3
+check_fails "non-numeric -n with -M" -M 1K -n x
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,57 @@
+#!/bin/bash
+# Log-field jobs: -k/-v/-w must be positive integers and only apply to the
+# jobs that read them, and histogram buckets round down even for values
+# near the ends of the 64-bit range.
+#
+# Usage: bash tests/test_jobs.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+
+# check <name> <input> <expected> <main args...>: sorted output must match
+check() {
+	local name=$1 input=$2 expected=$3
+	shift 3
+	local output
+	output=$(printf '%b' "$input" | ./main "$@" 2>/dev/null | sort)
+	if [[ $output == "$expected" ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: expected '$expected' but got '$output'"
+		((failures++))
+	fi
+}
+
+# check_fails <name> <main args...>: ./main must exit non-zero with no output
+check_fails() {
+	local name=$1
+	shift
+	local output
+	output=$(printf '1 a 5\n' | ./main "$@" 2>/dev/null)
+	if [[ $? -ne 0 && -z $output ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: exited zero or printed output"
+		((failures++))
+	fi
+}
+
+check "sum" '1 a 5\n2 b 7\n3 a -2\n' $'a 3\nb 7' -j sum -k 2 -v 3
+check "histogram" '1 a 5\n2 b 17\n3 c -1\n4 d -10\n' $'-10 2\n0 1\n10 1' -j histogram -v 3 -w 10
+check "histogram at the ends of the range" \
+	'1 a -9223372036854775808\n2 b -9223372036854775800\n3 c 9223372036854775807\n' \
+	$'-9223372036854775800 1\n9223372036854775800 1' -j histogram -v 3 -w 10
+
+check_fails "zero width" -j histogram -v 3 -w 0
+check_fails "negative width" -j histogram -v 3 -w -5
+check_fails "non-numeric fields" -j sum -k x -v y
+check_fails "trailing characters" -j sum -k 2x -v 3
+check_fails "field 0" -j count -k 0
+check_fails "-k for wordcount" -k 2
+check_fails "-w for sum" -j sum -k 2 -v 3 -w 10
+check_fails "-k for histogram" -j histogram -k 2 -v 3
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,53 @@
+#!/bin/bash
+# Long lines: the mapper tokenizes its read buffers as a stream, so words
+# on a line of several hundred KB are all counted, including a UTF-8
+# character split across the mapper's 64KB read boundary.
+#
+# Usage: bash tests/test_longline.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# One ~600KB line. "ab " x 21843 plus "cc " is 65532 bytes, so the two
+# bytes of the next word's "é" are bytes 65535 and 65536 (from 0): on
+# either side of the end of the mapper's first 64KB read of the file.
+awk 'BEGIN {
+	for (i = 0; i < 21843; i++) printf "ab "
+	printf "cc café "
+	for (i = 0; i < 40000; i++) printf "ab café w%d ", i % 1000
+	printf "\n"
+}' >"$tmp/input"
+
+# Every word here is already lower case, so a plain split is the reference
+tr ' ' '\n' <"$tmp/input" | grep -v '^$' | sort | uniq -c |
+	awk '{ print $2, $1 }' | sort >"$tmp/expected"
+
+# check <name> <command...>: sorted output of the command on the line
+check() {
+	local name=$1
+	shift
+	if "$@" <"$tmp/input" 2>/dev/null | sort | cmp -s - "$tmp/expected"; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: counts differ from the reference"
+		((failures++))
+	fi
+}
+
+mapper_and_reducer() {
+	./mapper | ./reducer
+}
+
+check "mapper reading the file directly" mapper_and_reducer
+check "pipeline" ./main
+check "pipeline with -d" ./main -d
+check "pipeline with -f" ./main -f
+check "pipeline with -C" ./main -C
+check "pipeline with -M" ./main -M 64K
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Shared-table mode (-M): the output equals the partitioned shuffle's for
+# every job, and a table too small for the keys fails the run with "Shared
+# table is full" and a non-zero exit instead of printing partial counts.
+#
+# Usage: bash tests/test_shared.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+for ((i = 0; i < 2000; i++)); do echo "$i h$((i % 13)) x $((i * 37 % 101 - 50))"; done >"$tmp/log"
+# 5000 distinct words, more than a 1K table can take
+for ((i = 0; i < 5000; i++)); do echo "word$i common"; done >"$tmp/many"
+
+# check <name> <input> <main args...>
+check() {
+	local name=$1 input=$2
+	shift 2
+	local expected output
+	expected=$(./main "$@" <"$input" 2>/dev/null | sort)
+	output=$(./main -M 64K "$@" <"$input" 2>/dev/null | sort)
+	if [[ -n $expected && $output == "$expected" ]]; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: -M output differs from the partitioned output"
+		((failures++))
+	fi
+}
+
+for input in tests/input*.txt; do
+	check "wordcount $(basename "$input")" "$input"
+done
+check "wordcount with -C and 8 mappers" tests/input1.txt -C -m 8
+check "wordcount with -n" tests/input1.txt -n 3
+check "count" "$tmp/log" -j count -k 2
+check "sum" "$tmp/log" -j sum -k 2 -v 4
+check "min" "$tmp/log" -j min -k 2 -v 4
+check "max" "$tmp/log" -j max -k 2 -v 4
+check "distinct" "$tmp/log" -j distinct -k 2 -v 4
+check "histogram" "$tmp/log" -j histogram -v 4 -w 10
+
+output=$(./main -M 1K <"$tmp/many" 2>"$tmp/err")
+status=$?
+if [[ $status -ne 0 && -z $output ]] && grep -q "Shared table is full" "$tmp/err"; then
+	echo "PASS a full table fails the run"
+else
+	echo "FAIL a full table: exit status $status, $(wc -l <<<"$output") output line(s)"
+	((failures++))
+fi
+
+echo "$failures failure(s)"
+exit $((failures > 0))
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Multi-threaded finalize: a reducer with at least PARALLEL_MIN (65536)
+# entries sorts and formats them in shards on -t threads, and its output
+# must be byte-for-byte the same as with one thread. The distinct job also
+# checks that a key's "key\tvalue" entries are never split across shards.
+#
+# Usage: bash tests/test_threads.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# 100000 keys, many sharing their first two bytes
+awk 'BEGIN { for (i = 0; i < 100000; i++) printf "w%d %d\n", i, i % 7 + 1 }' >"$tmp/words"
+# 205000 "key\tvalue" entries: 20000 keys with 10 distinct values each,
+# and an 11th value for k0 to k4999
+awk 'BEGIN {
+	for (i = 0; i < 200000; i++) printf "k%d\tv%d 1\n", i % 20000, i % 13
+	for (i = 0; i < 5000; i++) printf "k%d\tx 1\n", i
+}' >"$tmp/pairs"
+
+# check <name> <input> <reducer args...>: -t 4 output must equal -t 1's
+check() {
+	local name=$1 input=$2
+	shift 2
+	./reducer -t 1 "$@" <"$input" >"$tmp/one" 2>/dev/null
+	./reducer -t 4 "$@" <"$input" >"$tmp/four" 2>/dev/null
+	if [[ -s $tmp/one ]] && cmp -s "$tmp/one" "$tmp/four"; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: -t 4 output differs from -t 1"
+		((failures++))
+	fi
+}
+
+check "wordcount" "$tmp/words"
+check "wordcount with -n" "$tmp/words" -n 4
+check "distinct" "$tmp/pairs" -j distinct
+check "distinct with -n" "$tmp/pairs" -j distinct -n 11
+
+# The distinct counts themselves, from the four-thread run
+./reducer -t 4 -j distinct <"$tmp/pairs" >"$tmp/four" 2>/dev/null
+if awk '{ n = substr($1, 2) + 0 }
+	$2 != (n < 5000 ? 11 : 10) { bad = 1 }
+	END { exit bad || NR != 20000 }' "$tmp/four"; then
+	echo "PASS distinct counts with -t 4"
+else
+	echo "FAIL distinct counts with -t 4: a key's values were split or lost"
+	((failures++))
+fi
+
+echo "$failures failure(s)"
+exit $((failures > 0))
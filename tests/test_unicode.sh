@@ -0,0 +1,38 @@
+#!/bin/bash
+# The mapper's UTF-8 path: non-ASCII letters are case-folded (final sigma,
+# long s), curly quotes and dashes are dropped, and other scripts are kept
+# whole, the same in every shuffle mode.
+#
+# Usage: bash tests/test_unicode.sh
+
+cd "$(dirname "$0")/.."
+
+make -s main mapper reducer >&2 || exit 1
+failures=0
+
+expected='café 2
+cafés 1
+mass 2
+naïve 2
+strasse 1
+straße 1
+ß 1
+μάκροσ 2
+σοφοσ 2
+σοφόσ 1
+мир 1
+привет 2
+日本語 1'
+
+for flags in "" "-d" "-C -m 1" "-f"; do
+	output=$(./main $flags <tests/input_unicode.txt 2>/dev/null | sort)
+	if [[ $output == "$expected" ]]; then
+		echo "PASS unicode ${flags:-(default)}"
+	else
+		echo "FAIL unicode ${flags:-(default)}: expected '$expected' but got '$output'"
+		((failures++))
+	fi
+done
+
+echo "$failures failure(s)"
+exit $((failures > 0))
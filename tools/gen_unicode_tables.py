@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Generate unicode_tables.h for the mapper's UTF-8 tokenizer.
+
+Usage: python3 tools/gen_unicode_tables.py > unicode_tables.h
+
+Two tables are emitted, both sorted by code point and searched with a
+binary search (ASCII never reaches them):
+
+  uc_class_ranges  runs of code points that are letters, other word
+                   characters (marks, digits) or characters that are
+                   deleted outright (curly quotes, dashes, soft hyphen).
+                   Anything not covered separates words.
+  uc_fold_ranges   simple case folding (CaseFolding.txt status C and S),
+                   compressed into runs of "start..end step stride, add
+                   delta". Folding rather than lowercasing makes e.g.
+                   final sigma and long s fold like their other forms.
+"""
+import sys
+import unicodedata
+
+UC_SEP, UC_LETTER, UC_OTHER, UC_DELETE = 0, 1, 2, 3
+
+# Matches what the ASCII path does with ' and - (and the curly quotes and
+# em dash mapper.c always stripped)
+DELETE = {0x00AD, 0x2010, 0x2011, 0x2014, 0x2018, 0x2019, 0x201C, 0x201D}
+
+
+def classify(cp):
+    if cp in DELETE:
+        return UC_DELETE
+    cat = unicodedata.category(chr(cp))
+    if cat[0] == "L":
+        return UC_LETTER
+    if cat[0] == "M" or cat == "Nd":
+        return UC_OTHER
+    return UC_SEP
+
+
+def class_runs():
+    runs = []
+    for cp in range(0x80, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        cls = classify(cp)
+        if cls == UC_SEP:
+            continue
+        if runs and runs[-1][1] == cp - 1 and runs[-1][2] == cls:
+            runs[-1][1] = cp
+        else:
+            runs.append([cp, cp, cls])
+    return runs
+
+
+def simple_fold(cp):
+    """The C or S mapping of cp in CaseFolding.txt, or cp itself.
+
+    str.casefold() is full folding (C + F). Where it gives one code point
+    that is the C mapping. Where it expands, the only simple mappings (S)
+    are the lowercase forms of capital sharp s and the Greek letters with
+    prosgegrammeni, which is what str.lower() returns for them.
+    """
+    c = chr(cp)
+    folded = c.casefold()
+    if len(folded) == 1:
+        return ord(folded)
+    low = c.lower()
+    if len(low) == 1 and low != c and low.casefold() == folded:
+        return ord(low)
+    return cp
+
+
+def fold_runs():
+    pairs = []
+    for cp in range(0x80, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        folded = simple_fold(cp)
+        if folded != cp:
+            pairs.append((cp, folded - cp))
+
+    runs = []  # [start, end, stride, delta]
+    for cp, delta in pairs:
+        if runs:
+            start, end, stride, d = runs[-1]
+            if d == delta:
+                if start == end and cp - end in (1, 2):
+                    runs[-1][1], runs[-1][2] = cp, cp - end
+                    continue
+                if cp - end == stride:
+                    runs[-1][1] = cp
+                    continue
+        runs.append([cp, cp, 1, delta])
+    return runs
+
+
+def main():
+    out = sys.stdout
+    classes = class_runs()
+    folds = fold_runs()
+    out.write("// Generated by tools/gen_unicode_tables.py from Unicode %s. Do not edit.\n"
+              % unicodedata.unidata_version)
+    out.write("#ifndef UNICODE_TABLES_H\n#define UNICODE_TABLES_H\n\n")
+    out.write("#define UC_SEP 0\n#define UC_LETTER 1\n#define UC_OTHER 2\n#define UC_DELETE 3\n\n")
+    out.write("struct uc_class_range {\n    unsigned int start, end;\n    unsigned char cls;\n};\n\n")
+    out.write("struct uc_fold_range {\n    unsigned int start, end;\n    unsigned char stride;\n    int delta;\n};\n\n")
+
+    out.write("static const struct uc_class_range uc_class_ranges[] = {\n")
+    for start, end, cls in classes:
+        out.write("    {0x%04X, 0x%04X, %d},\n" % (start, end, cls))
+    out.write("};\n\n")
+
+    out.write("static const struct uc_fold_range uc_fold_ranges[] = {\n")
+    for start, end, stride, delta in folds:
+        out.write("    {0x%04X, 0x%04X, %d, %d},\n" % (start, end, stride, delta))
+    out.write("};\n\n")
+
+    out.write("#define UC_CLASS_RANGES (sizeof(uc_class_ranges) / sizeof(uc_class_ranges[0]))\n")
+    out.write("#define UC_FOLD_RANGES (sizeof(uc_fold_ranges) / sizeof(uc_fold_ranges[0]))\n\n")
+    out.write("#endif\n")
+
+
+if __name__ == "__main__":
+    main()
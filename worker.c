@@ -0,0 +1,173 @@
+// Compile: gcc -O2 worker.c -o worker
+// Run: ./worker [-a address] [-p port]
+//
+// Worker agent for distributed mode (./main -H host:port,...). It listens on
+// TCP (port 5050 by default, 0 picks a free one) and serves each connection
+// in its own process. A connection starts with one line, "mapper <args>" or
+// "reducer <args>"; the worker then runs ./mapper or ./reducer from its
+// working directory with the connection as stdin and stdout, so the task
+// speaks the same protocol it speaks over main's pipes. When the task exits
+// cleanly the connection is closed normally; when it fails the connection is
+// reset, which main treats like a crashed child.
+//
+// There is no authentication: anyone who can connect can run tasks. The
+// worker therefore listens on 127.0.0.1 unless -a names another address
+// (e.g. -a 0.0.0.0 on a trusted cluster network), and it refuses the task
+// options that touch this host's files or descriptors.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 5050
+#define MAX_HELLO 512
+#define MAX_ARGS 32
+
+// Task options a remote peer may not pass: the reducer's checkpoint file
+// (-c) would let it write any path the worker can, and the mapper's shared
+// table (-M) names a descriptor of the local main process
+const char *refused_args[] = {"-c", "-M"};
+#define NUM_REFUSED (int)(sizeof(refused_args) / sizeof(refused_args[0]))
+
+void error_exit(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+// Read the handshake one byte at a time so nothing after the newline is
+// taken away from the task
+int read_hello(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    while (len < size - 1) {
+        char c;
+        if (read(fd, &c, 1) != 1) return -1;
+        if (c == '\n') {
+            buf[len] = '\0';
+            return 0;
+        }
+        buf[len++] = c;
+    }
+    return -1;
+}
+
+void serve(int fd) {
+    char hello[MAX_HELLO];
+    char path[64];
+    char *argv[MAX_ARGS + 1];
+    int argc = 0;
+
+    if (read_hello(fd, hello, sizeof(hello)) < 0) {
+        fprintf(stderr, "Worker: bad handshake\n");
+        exit(1);
+    }
+    for (char *arg = strtok(hello, " "); arg && argc < MAX_ARGS; arg = strtok(NULL, " ")) {
+        argv[argc++] = arg;
+    }
+    argv[argc] = NULL;
+
+    // Only the two task programs may be started
+    if (argc == 0 || (strcmp(argv[0], "mapper") != 0 && strcmp(argv[0], "reducer") != 0)) {
+        fprintf(stderr, "Worker: unknown task '%s'\n", argc ? argv[0] : "");
+        exit(1);
+    }
+    for (int i = 1; i < argc; i++) {
+        for (int r = 0; r < NUM_REFUSED; r++) {
+            if (strcmp(argv[i], refused_args[r]) == 0) {
+                fprintf(stderr, "Worker: %s %s not allowed\n", argv[0], argv[i]);
+                exit(1);
+            }
+        }
+    }
+    snprintf(path, sizeof(path), "./%s", argv[0]);
+    argv[0] = path;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pid_t pid = fork();
+    if (pid < 0) error_exit("fork");
+    if (pid == 0) {
+        if (dup2(fd, STDIN_FILENO) < 0) error_exit("dup2 stdin");
+        if (dup2(fd, STDOUT_FILENO) < 0) error_exit("dup2 stdout");
+        close(fd);
+        execv(argv[0], argv);
+        error_exit("exec");
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Worker: %s failed, resetting connection\n", argv[0]);
+        struct linger reset = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+    close(fd);
+    exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    int port = DEFAULT_PORT;
+    const char *address = "127.0.0.1";
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:")) != -1) {
+        switch (opt) {
+        case 'a':
+            address = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-a address] [-p port]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) error_exit("socket");
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Bad listen address: %s\n", address);
+        exit(1);
+    }
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) error_exit("bind");
+    if (listen(listen_fd, 64) < 0) error_exit("listen");
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len);
+    fprintf(stderr, "Worker listening on %s port %d\n", address, ntohs(addr.sin_port));
+
+    // Connection handlers are never waited for
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(fd);
+            continue;
+        }
+        if (pid == 0) {
+            close(listen_fd);
+            signal(SIGCHLD, SIG_DFL);
+            serve(fd);
+        }
+        close(fd);
+    }
+}